@@ -0,0 +1,140 @@
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+/**
+ * This measures the time to dispatch callbacks, first directly with a
+ * CallbackRegistry, then while each dispatch removes and adds a callback, and
+ * then through Namespace state change callbacks. It doesn't need a Face.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <cnl-cpp/blob-object.hpp>
+#include <cnl-cpp/callback-registry.hpp>
+#include <cnl-cpp/namespace.hpp>
+
+using namespace std;
+using namespace cnl_cpp;
+using namespace ndn;
+using namespace ndn::func_lib;
+
+typedef function<void(size_t& count)> OnCount;
+
+static const size_t N_DISPATCHES = 1000000;
+
+/**
+ * Get the average time of one operation.
+ * @param start The time before all the operations.
+ * @param nOperations The number of operations.
+ * @return The average time in nanoseconds.
+ */
+static double
+getNanosecondsPerOperation
+  (chrono::steady_clock::time_point start, size_t nOperations)
+{
+  return (double)chrono::duration_cast<chrono::nanoseconds>
+    (chrono::steady_clock::now() - start).count() / nOperations;
+}
+
+static void
+benchmarkRegistry(int nCallbacks)
+{
+  CallbackRegistry<OnCount> registry;
+  for (int i = 0; i < nCallbacks; ++i)
+    registry.add
+      (Namespace::getNextCallbackId(), [](size_t& count) { ++count; });
+
+  size_t count = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t i = 0; i < N_DISPATCHES; ++i)
+    registry.dispatch([&](uint64_t callbackId, OnCount& onCount) {
+      onCount(count);
+      return false;
+    });
+  double dispatchTime = getNanosecondsPerOperation(start, N_DISPATCHES);
+
+  // Each dispatch removes the first callback and adds a new one at the end,
+  // as when a callback removes itself and registers another.
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < N_DISPATCHES; ++i)
+    registry.dispatch([&](uint64_t callbackId, OnCount& onCount) {
+      onCount(count);
+      if (registry.remove(callbackId))
+        registry.add
+          (Namespace::getNextCallbackId(), [](size_t& count) { ++count; });
+      return true;
+    });
+  double churnTime = getNanosecondsPerOperation(start, N_DISPATCHES);
+
+  if (count != N_DISPATCHES * (nCallbacks + 1))
+    cout << "Error: Not all callbacks were called" << endl;
+
+  cout << nCallbacks << " callbacks: dispatch " << dispatchTime <<
+    " ns, dispatch with remove and add " << churnTime << " ns" << endl;
+}
+
+static void
+benchmarkStateChanged(int nCallbacks)
+{
+  Namespace stream("/test/stream");
+  Namespace& segment = stream[Name::Component::fromSegment(0)];
+  ptr_lib::shared_ptr<Data> data =
+    ptr_lib::make_shared<Data>(segment.getName());
+  const uint8_t content[] = { 1, 2, 3, 4 };
+  data->setContent(Blob(content, sizeof(content)));
+  segment.setData(data);
+  segment.setObject_(ptr_lib::make_shared<BlobObject>(data->getContent()));
+
+  size_t count = 0;
+  for (int i = 0; i < nCallbacks; ++i)
+    stream.addOnStateChanged
+      ([&](Namespace& nameSpace, Namespace& changedNamespace,
+           NamespaceState state, uint64_t callbackId) { ++count; });
+
+  // objectNeeded finds the object and sets the state again to OBJECT_READY.
+  size_t nCalls = N_DISPATCHES / 10;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t i = 0; i < nCalls; ++i)
+    segment.objectNeeded();
+  double stateChangedTime = getNanosecondsPerOperation(start, nCalls);
+
+  if (count != nCalls * nCallbacks)
+    cout << "Error: Not all OnStateChanged callbacks were called" << endl;
+
+  cout << nCallbacks << " OnStateChanged callbacks: objectNeeded " <<
+    stateChangedTime << " ns" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    benchmarkRegistry(1);
+    benchmarkRegistry(2);
+    benchmarkRegistry(8);
+    benchmarkRegistry(64);
+
+    benchmarkStateChanged(1);
+    benchmarkStateChanged(8);
+    benchmarkStateChanged(64);
+  } catch (std::exception& e) {
+    cout << "exception: " << e.what() << endl;
+  }
+  return 0;
+}
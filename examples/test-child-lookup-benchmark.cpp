@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+/**
+ * This measures the time to create child nodes of a Namespace node out of
+ * order, to look them up, and to get the sorted child components, for 1000,
+ * 100000 and 1000000 children. It doesn't need a Face.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cnl-cpp/namespace.hpp>
+
+using namespace std;
+using namespace cnl_cpp;
+using namespace ndn;
+
+/**
+ * Get the average time of one operation.
+ * @param duration The time for all the operations.
+ * @param nOperations The number of operations.
+ * @return The average time in nanoseconds.
+ */
+static double
+getNanosecondsPerOperation
+  (chrono::steady_clock::duration duration, size_t nOperations)
+{
+  return (double)chrono::duration_cast<chrono::nanoseconds>
+    (duration).count() / nOperations;
+}
+
+static void
+benchmarkChildren(size_t nChildren)
+{
+  Namespace stream("/test/stream");
+
+  // Make the components first so that the timing only includes the Namespace.
+  vector<Name::Component> components;
+  components.reserve(nChildren);
+  for (size_t i = 0; i < nChildren; ++i)
+    components.push_back(Name::Component::fromSegment(i));
+  // Create in random order as a consumer would for out-of-order segments, so
+  // that the sorted view of the children is not kept valid while creating.
+  vector<Name::Component> shuffledComponents(components);
+  shuffle(shuffledComponents.begin(), shuffledComponents.end(), mt19937(1));
+  // Look up in a different random order.
+  vector<Name::Component> lookupComponents(components);
+  shuffle(lookupComponents.begin(), lookupComponents.end(), mt19937(2));
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t i = 0; i < nChildren; ++i)
+    stream[shuffledComponents[i]];
+  chrono::steady_clock::duration createTime =
+    chrono::steady_clock::now() - start;
+
+  start = chrono::steady_clock::now();
+  size_t nFound = 0;
+  for (size_t i = 0; i < nChildren; ++i) {
+    if (stream.hasChild(lookupComponents[i]))
+      ++nFound;
+  }
+  chrono::steady_clock::duration hasChildTime =
+    chrono::steady_clock::now() - start;
+
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < nChildren; ++i) {
+    if (stream.getChild(lookupComponents[i]).getNameComponent().isSegment())
+      ++nFound;
+  }
+  chrono::steady_clock::duration getChildTime =
+    chrono::steady_clock::now() - start;
+
+  // The first call sorts the children which were created out of order.
+  start = chrono::steady_clock::now();
+  size_t nChildComponents = stream.getChildComponents()->size();
+  chrono::steady_clock::duration sortTime = chrono::steady_clock::now() - start;
+
+  // The second call uses the sorted view.
+  start = chrono::steady_clock::now();
+  nChildComponents += stream.getChildComponents()->size();
+  chrono::steady_clock::duration getChildComponentsTime =
+    chrono::steady_clock::now() - start;
+
+  if (nFound != 2 * nChildren || nChildComponents != 2 * nChildren)
+    cout << "Error: Not all children were found" << endl;
+
+  cout << nChildren << " children: create " <<
+    getNanosecondsPerOperation(createTime, nChildren) << " ns, hasChild " <<
+    getNanosecondsPerOperation(hasChildTime, nChildren) << " ns, getChild " <<
+    getNanosecondsPerOperation(getChildTime, nChildren) <<
+    " ns, getChildComponents with sort " <<
+    chrono::duration<double, milli>(sortTime).count() <<
+    " ms, getChildComponents when sorted " <<
+    chrono::duration<double, milli>(getChildComponentsTime).count() <<
+    " ms" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    benchmarkChildren(1000);
+    benchmarkChildren(100000);
+    benchmarkChildren(1000000);
+  } catch (std::exception& e) {
+    cout << "exception: " << e.what() << endl;
+  }
+  return 0;
+}
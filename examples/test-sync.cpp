@@ -132,11 +132,11 @@ int main(int argc, char** argv)
     auto onStateChanged = [&]
       (Namespace& nameSpace, Namespace& changedNamespace, NamespaceState state,
        uint64_t callbackId) {
-      if (state == NamespaceState_NAME_EXISTS &&
-          !userPrefix.getName().isPrefixOf(changedNamespace.getName()))
+      if (!userPrefix.getName().isPrefixOf(changedNamespace.getName()))
         cout << "Received " << changedNamespace.getName().toUri() << endl;
     };
-    applicationPrefix.addOnStateChanged(onStateChanged);
+    applicationPrefix.addOnStateChanged
+      (onStateChanged, Namespace::getStateMask(NamespaceState_NAME_EXISTS));
 
     chrono::milliseconds publishIntervalMs(1000);
     Name::Component component = Name("/%00").get(0);
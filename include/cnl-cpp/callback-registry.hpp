@@ -0,0 +1,283 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#ifndef CNL_CPP_CALLBACK_REGISTRY_HPP
+#define CNL_CPP_CALLBACK_REGISTRY_HPP
+
+#include <vector>
+#include <ndn-ind/common.hpp>
+
+namespace cnl_cpp {
+
+/**
+ * A CallbackRegistry holds callbacks by callback ID (from
+ * Namespace::getNextCallbackId()) and calls them in the order they were added.
+ * It is safe to add and remove callbacks while dispatching, even from
+ * callbacks of a nested dispatch. A callback which is added during a dispatch
+ * is not called until the next dispatch. A callback which is removed during a
+ * dispatch is marked as a tombstone (its callback ID is set to 0) and is not
+ * called again, and the tombstones are removed when the outermost dispatch
+ * finishes. Since callback IDs are never reused, the callback ID of a slot
+ * also serves as its generation tag. Dispatching does not allocate memory or
+ * look up callback IDs.
+ * An empty registry is just a null pointer. The first add() allocates the
+ * storage, which has room for InlineCapacity callbacks before it allocates
+ * more.
+ * @tparam Callback The type of the stored callback, which must be default
+ * constructible.
+ * @tparam InlineCapacity The number of callbacks in the storage allocated by
+ * the first add().
+ */
+template<class Callback, size_t InlineCapacity = 2>
+class CallbackRegistry {
+public:
+  CallbackRegistry()
+  {}
+
+  /**
+   * Add the callback with the given callback ID. If this is called during a
+   * dispatch, the callback is not called until the next dispatch.
+   * @param callbackId The callback ID, which must not be 0.
+   * @param callback The callback, which is copied.
+   */
+  void
+  add(uint64_t callbackId, const Callback& callback)
+  {
+    if (!storage_)
+      storage_.reset(new Storage());
+
+    if (storage_->dispatchDepth_ > 0)
+      // Don't change the slots that are being dispatched.
+      storage_->pending_.push_back(Slot(callbackId, callback));
+    else
+      storage_->append(Slot(callbackId, callback));
+    ++storage_->nCallbacks_;
+  }
+
+  /**
+   * Remove the callback with the given callback ID. If this is called during a
+   * dispatch, the callback is not called again and its slot is removed when
+   * the outermost dispatch finishes.
+   * @param callbackId The callback ID.
+   * @return True if the callback was found and removed, false if not found.
+   */
+  bool
+  remove(uint64_t callbackId)
+  {
+    if (!storage_ || callbackId == 0)
+      return false;
+
+    for (size_t i = 0; i < storage_->nSlots_; ++i) {
+      Slot& slot = storage_->getSlot(i);
+      if (slot.callbackId_ == callbackId) {
+        // Set the tombstone but don't change the callback, which may be running.
+        slot.callbackId_ = 0;
+        --storage_->nCallbacks_;
+        if (storage_->dispatchDepth_ > 0)
+          storage_->hasTombstones_ = true;
+        else
+          storage_->compact();
+        return true;
+      }
+    }
+
+    for (size_t i = 0; i < storage_->pending_.size(); ++i) {
+      if (storage_->pending_[i].callbackId_ == callbackId) {
+        // A pending callback is not running, so erase it now.
+        storage_->pending_.erase(storage_->pending_.begin() + i);
+        --storage_->nCallbacks_;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * Remove all callbacks. If this is called during a dispatch, the remaining
+   * callbacks of the dispatch are not called.
+   */
+  void
+  clear()
+  {
+    if (!storage_)
+      return;
+
+    if (storage_->dispatchDepth_ > 0) {
+      for (size_t i = 0; i < storage_->nSlots_; ++i)
+        storage_->getSlot(i).callbackId_ = 0;
+      storage_->pending_.clear();
+      storage_->nCallbacks_ = 0;
+      storage_->hasTombstones_ = true;
+    }
+    else
+      storage_.reset();
+  }
+
+  /**
+   * Get the number of callbacks, including callbacks added during a dispatch
+   * and not including removed callbacks.
+   * @return The number of callbacks.
+   */
+  size_t
+  size() const { return storage_ ? storage_->nCallbacks_ : 0; }
+
+  /**
+   * Check if there are no callbacks, as described in size().
+   * @return True if there are no callbacks.
+   */
+  bool
+  empty() const { return size() == 0; }
+
+  /**
+   * Call function(callbackId, callback) for each callback in the order they
+   * were added, until the function returns true.
+   * @param function The function to call, which returns true to stop the
+   * dispatch. To catch exceptions from a callback, catch them in the function.
+   * @return True if the function returned true, otherwise false.
+   */
+  template<class Function> bool
+  dispatch(Function function)
+  {
+    if (!storage_ || storage_->nSlots_ == 0)
+      return false;
+
+    // Keep a reference to the storage since a callback may call clear().
+    Storage& storage = *storage_;
+    // add() doesn't change the slots during a dispatch, so nSlots_ is fixed.
+    size_t nSlots = storage.nSlots_;
+    bool isStopped = false;
+    ++storage.dispatchDepth_;
+    try {
+      for (size_t i = 0; i < nSlots; ++i) {
+        Slot& slot = storage.getSlot(i);
+        if (slot.callbackId_ != 0 && function(slot.callbackId_, slot.callback_)) {
+          isStopped = true;
+          break;
+        }
+      }
+    } catch (...) {
+      finishDispatch();
+      throw;
+    }
+
+    finishDispatch();
+    return isStopped;
+  }
+
+private:
+  // Disable the copy constructor and assignment operator.
+  CallbackRegistry(const CallbackRegistry& other);
+  CallbackRegistry& operator=(const CallbackRegistry& other);
+
+  class Slot {
+  public:
+    Slot()
+    : callbackId_(0)
+    {}
+
+    Slot(uint64_t callbackId, const Callback& callback)
+    : callbackId_(callbackId), callback_(callback)
+    {}
+
+    // 0 for a tombstone.
+    uint64_t callbackId_;
+    Callback callback_;
+  };
+
+  class Storage {
+  public:
+    Storage()
+    : nSlots_(0), nCallbacks_(0), dispatchDepth_(0), hasTombstones_(false)
+    {}
+
+    Slot&
+    getSlot(size_t i)
+    {
+      return i < InlineCapacity ? inline_[i] : overflow_[i - InlineCapacity];
+    }
+
+    void
+    append(const Slot& slot)
+    {
+      if (nSlots_ < InlineCapacity)
+        inline_[nSlots_] = slot;
+      else
+        overflow_.push_back(slot);
+      ++nSlots_;
+    }
+
+    /**
+     * Remove the tombstones, keeping the order of the other slots.
+     */
+    void
+    compact()
+    {
+      size_t nKept = 0;
+      for (size_t i = 0; i < nSlots_; ++i) {
+        if (getSlot(i).callbackId_ != 0) {
+          if (i != nKept)
+            getSlot(nKept) = getSlot(i);
+          ++nKept;
+        }
+      }
+
+      // Release the callbacks in the unused slots.
+      for (size_t i = nKept; i < nSlots_ && i < InlineCapacity; ++i)
+        inline_[i] = Slot();
+      overflow_.resize(nKept > InlineCapacity ? nKept - InlineCapacity : 0);
+      nSlots_ = nKept;
+      hasTombstones_ = false;
+    }
+
+    Slot inline_[InlineCapacity];
+    std::vector<Slot> overflow_;
+    // The callbacks added during a dispatch.
+    std::vector<Slot> pending_;
+    size_t nSlots_;
+    size_t nCallbacks_;
+    int dispatchDepth_;
+    bool hasTombstones_;
+  };
+
+  /**
+   * Decrement the dispatch depth. If this finishes the outermost dispatch, then
+   * remove the tombstones and append the callbacks added during the dispatch.
+   */
+  void
+  finishDispatch()
+  {
+    if (--storage_->dispatchDepth_ > 0)
+      return;
+
+    if (storage_->hasTombstones_)
+      storage_->compact();
+    for (size_t i = 0; i < storage_->pending_.size(); ++i)
+      storage_->append(storage_->pending_[i]);
+    storage_->pending_.clear();
+  }
+
+  ndn::ptr_lib::unique_ptr<Storage> storage_;
+};
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#ifndef CNL_CPP_INTEREST_WINDOW_CONTROLLER_HPP
+#define CNL_CPP_INTEREST_WINDOW_CONTROLLER_HPP
+
+#include <chrono>
+#include "object.hpp"
+
+namespace cnl_cpp {
+
+/**
+ * InterestWindowController is a base class for the congestion control policy
+ * which decides how many Interests a fetcher such as SegmentStreamHandler keeps
+ * in flight. The fetcher reports each Data packet and each congestion signal,
+ * and calls getWindowSize() before expressing new Interests. A derived class
+ * implements increase() and decrease(). To avoid reacting many times to one
+ * congestion event, this calls decrease() at most once per window of received
+ * Data packets. If the Data packets stop arriving, this calls decrease() at
+ * most once per retransmission timeout (see setRetransmissionTimeout).
+ */
+class cnl_cpp_dll InterestWindowController {
+public:
+  /**
+   * Create an InterestWindowController with the given window.
+   * @param initialWindow The initial window. If less than 1, use 1.
+   * @param maxWindow The maximum window. If less than initialWindow, use
+   * initialWindow.
+   */
+  InterestWindowController(double initialWindow, double maxWindow);
+
+  virtual ~InterestWindowController();
+
+  /**
+   * Call this when a Data packet arrives without a congestion mark.
+   */
+  void
+  onData();
+
+  /**
+   * Call this when a Data packet arrives with a congestion mark.
+   */
+  void
+  onCongestionMark();
+
+  /**
+   * Call this when a network Nack arrives with the reason CONGESTION.
+   */
+  void
+  onCongestionNack();
+
+  /**
+   * Call this when an Interest times out, or when the fetcher re-expresses it
+   * because later Data packets arrived without its Data.
+   */
+  void
+  onTimeout();
+
+  /**
+   * Set the retransmission timeout of the fetcher's Interests, which is the
+   * minimum time between calls to decrease() while fewer than a window of Data
+   * packets arrive. The fetcher should update this as the retransmission
+   * timeout changes.
+   * @param retransmissionTimeout The retransmission timeout. If you don't set
+   * this, the default is 1 second.
+   */
+  void
+  setRetransmissionTimeout(std::chrono::nanoseconds retransmissionTimeout)
+  {
+    retransmissionTimeout_ = retransmissionTimeout;
+  }
+
+  /**
+   * Get the current window, which may be fractional.
+   * @return The window.
+   */
+  double
+  getWindow() const { return window_; }
+
+  /**
+   * Get the number of Interests to keep in flight, which is the current window
+   * rounded down, but at least 1.
+   * @return The window size.
+   */
+  int
+  getWindowSize() const { return window_ < 1 ? 1 : (int)window_; }
+
+  /**
+   * Get the maximum window given to the constructor.
+   * @return The maximum window.
+   */
+  double
+  getMaxWindow() const { return maxWindow_; }
+
+protected:
+  /**
+   * Increase window_ for a received Data packet. The result is limited to
+   * getMaxWindow().
+   */
+  virtual void
+  increase() = 0;
+
+  /**
+   * Decrease window_ for a congestion signal. The result is limited to at
+   * least 1.
+   */
+  virtual void
+  decrease() = 0;
+
+  double window_;
+
+private:
+  void
+  onCongestion();
+
+  double maxWindow_;
+  // The number of Data packets since the last call to decrease().
+  int nDataSinceDecrease_;
+  std::chrono::steady_clock::time_point lastDecreaseTime_;
+  std::chrono::nanoseconds retransmissionTimeout_;
+};
+
+/**
+ * FixedInterestWindowController keeps the window at a constant size, ignoring
+ * congestion signals.
+ */
+class cnl_cpp_dll FixedInterestWindowController
+  : public InterestWindowController {
+public:
+  /**
+   * Create a FixedInterestWindowController with the given window.
+   * @param window The constant window. If less than 1, use 1.
+   */
+  FixedInterestWindowController(int window)
+  : InterestWindowController(window, window)
+  {}
+
+protected:
+  virtual void
+  increase();
+
+  virtual void
+  decrease();
+};
+
+/**
+ * AimdInterestWindowController uses additive increase, multiplicative decrease
+ * with slow start. While the window is less than the slow start threshold, the
+ * window increases by 1 for each Data packet, otherwise by 1 / window. On a
+ * congestion signal, the window and slow start threshold become the window
+ * times the decrease factor.
+ */
+class cnl_cpp_dll AimdInterestWindowController
+  : public InterestWindowController {
+public:
+  /**
+   * Create an AimdInterestWindowController with the given values.
+   * @param initialWindow (optional) The initial window. If omitted, use 2.
+   * @param maxWindow (optional) The maximum window. If omitted, use 1000.
+   * @param decreaseFactor (optional) The factor to multiply the window on a
+   * congestion signal, between 0 and 1. If omitted, use 0.5.
+   */
+  AimdInterestWindowController
+    (double initialWindow = 2, double maxWindow = 1000,
+     double decreaseFactor = 0.5);
+
+protected:
+  virtual void
+  increase();
+
+  virtual void
+  decrease();
+
+private:
+  double decreaseFactor_;
+  double slowStartThreshold_;
+};
+
+/**
+ * CubicInterestWindowController uses the CUBIC window growth function of
+ * RFC 8312 with slow start and fast convergence. After a congestion signal, the
+ * window grows as a cubic function of the time since the signal, which
+ * quickly returns to the window before the signal and then probes beyond it.
+ * This fills high bandwidth-delay paths faster than AIMD.
+ */
+class cnl_cpp_dll CubicInterestWindowController
+  : public InterestWindowController {
+public:
+  /**
+   * Create a CubicInterestWindowController with the given values.
+   * @param initialWindow (optional) The initial window. If omitted, use 2.
+   * @param maxWindow (optional) The maximum window. If omitted, use 1000.
+   * @param decreaseFactor (optional) The factor to multiply the window on a
+   * congestion signal, between 0 and 1. If omitted, use 0.7 from RFC 8312.
+   * @param cubicFactor (optional) The scaling constant C of the cubic function,
+   * in window units per second cubed. If omitted, use 0.4 from RFC 8312.
+   */
+  CubicInterestWindowController
+    (double initialWindow = 2, double maxWindow = 1000,
+     double decreaseFactor = 0.7, double cubicFactor = 0.4);
+
+protected:
+  virtual void
+  increase();
+
+  virtual void
+  decrease();
+
+private:
+  double decreaseFactor_;
+  double cubicFactor_;
+  double slowStartThreshold_;
+  // The window just before the last decrease.
+  double lastMaxWindow_;
+  // The time for the cubic function to increase to lastMaxWindow_, in seconds.
+  double k_;
+  std::chrono::steady_clock::time_point epochStart_;
+};
+
+}
+
+#endif
@@ -23,6 +23,8 @@
 #define CNL_CPP_NAMESPACE_HPP
 
 #include <map>
+#include <unordered_map>
+#include <queue>
 #include <ndn-ind/face.hpp>
 #ifdef NDN_CPP_HAVE_BOOST_ASIO
 #include <boost/atomic.hpp>
@@ -32,6 +34,7 @@
 #include <ndn-ind/encrypt/decryptor-v2.hpp>
 #include <ndn-ind/sync/full-psync2017.hpp>
 #include "blob-object.hpp"
+#include "callback-registry.hpp"
 
 namespace cnl_cpp {
 
@@ -67,7 +70,21 @@ enum NamespaceValidateState {
   NamespaceValidateState_VALIDATE_FAILURE = 3
 };
 
+/**
+ * An IncomingInterestOverloadPolicy specifies what to do with an incoming
+ * Interest when the table of pending incoming Interests is full. See
+ * Namespace::setMaxPendingIncomingInterests.
+ */
+enum IncomingInterestOverloadPolicy {
+  IncomingInterestOverloadPolicy_DROP_OLDEST = 0,
+  IncomingInterestOverloadPolicy_REJECT_NEW =  1,
+  IncomingInterestOverloadPolicy_NACK =        2
+};
+
 class PendingIncomingInterestTable;
+class OutgoingInterestTable;
+class RttEstimator;
+class NamespaceNodePool;
 
 /**
  * Namespace is the main class that represents the name tree and related
@@ -88,8 +105,76 @@ public:
     (Namespace& nameSpace, Namespace& neededNamespace,
      uint64_t callbackId)> OnObjectNeeded;
 
+  typedef ndn::func_lib::function<void
+    (Namespace& nameSpace, Namespace& evictedNamespace, size_t nBytes,
+     uint64_t callbackId)> OnEvicted;
+
+  typedef ndn::func_lib::function<void
+    (Namespace& nameSpace, Namespace& retransmittedNamespace,
+     uint64_t callbackId)> OnInterestRetransmitted;
+
+  typedef ndn::func_lib::function<void
+    (Namespace& nameSpace, const std::vector<Namespace*>& changedNamespaces,
+     uint64_t callbackId)> OnStateChangedBatch;
+
+  typedef ndn::func_lib::function<void
+    (Namespace& nameSpace, Namespace& interestNamespace,
+     const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest,
+     uint64_t callbackId)> OnIncomingInterestTimeout;
+
   class Impl;
 
+  /**
+   * FaceCounters has the counts of packets for a Face which receives Interests
+   * for the Namespace tree. See getFaceCounters.
+   */
+  class cnl_cpp_dll FaceCounters {
+  public:
+    FaceCounters()
+    : nInInterests_(0), nOutData_(0), nOutNacks_(0), nDroppedInterests_(0)
+    {}
+
+    /**
+     * Get the number of Interests received from the Face.
+     * @return The number of Interests.
+     */
+    uint64_t
+    getNInInterests() const { return nInInterests_; }
+
+    /**
+     * Get the number of Data packets sent to the Face, either directly from
+     * the tree or to satisfy a pending Interest.
+     * @return The number of Data packets.
+     */
+    uint64_t
+    getNOutData() const { return nOutData_; }
+
+    /**
+     * Get the number of Nacks sent to the Face by the overload policy of
+     * Namespace::setMaxPendingIncomingInterests.
+     * @return The number of Nacks.
+     */
+    uint64_t
+    getNOutNacks() const { return nOutNacks_; }
+
+    /**
+     * Get the number of Interests from the Face which were dropped because
+     * they were duplicates or rejected by the overload policy.
+     * @return The number of dropped Interests.
+     */
+    uint64_t
+    getNDroppedInterests() const { return nDroppedInterests_; }
+
+  private:
+    friend class Namespace::Impl;
+    friend class PendingIncomingInterestTable;
+
+    uint64_t nInInterests_;
+    uint64_t nOutData_;
+    uint64_t nOutNacks_;
+    uint64_t nDroppedInterests_;
+  };
+
   /**
    * Namespace::Handler is a base class for Handler classes.
    */
@@ -163,20 +248,32 @@ public:
    */
   Namespace(const ndn::Name& name, ndn::KeyChain* keyChain = 0)
   : impl_(ndn::ptr_lib::make_shared<Impl>
-          (*this, name, keyChain, ndn::ptr_lib::make_shared<bool>(false)))
+          (*this, name, keyChain, ndn::ptr_lib::shared_ptr<bool>()))
   {
   }
 
+  ~Namespace();
+
   /**
    * Get the name of this node in the name tree. This includes the name
-   * components of parent nodes. To get the name component of just this node,
-   * use getName()[-1].
-   * @return The name of this namespace. NOTE: You must not change the name -
-   * if you need to change it then make a copy.
+   * components of parent nodes. Only the root node stores its full name, so
+   * for other nodes this builds the name from the name components of the
+   * parent nodes each time. To get the name component of just this node, use
+   * getNameComponent().
+   * @return A copy of the name of this namespace.
    */
-  const ndn::Name&
+  ndn::Name
   getName() const { return impl_->getName(); }
 
+  /**
+   * Get the name component of this node, which is the same as getName()[-1]
+   * but does not build the full name.
+   * @return The name component of this node. If this is the root and its name
+   * is empty, return an empty name component.
+   */
+  const ndn::Name::Component&
+  getNameComponent() const { return impl_->getNameComponent(); }
+
   /**
    * Get the parent namespace.
    * @return The parent namespace, or null if this is the root of the tree.
@@ -207,6 +304,19 @@ public:
   ndn::ptr_lib::shared_ptr<ndn::NetworkNack>
   getNetworkNack() { return impl_->getNetworkNack(); }
 
+  /**
+   * Check if the freshness period of the Data packet attached to this node has
+   * ended. When this happens, a timer on the root node sets this flag and, if
+   * the state is NamespaceState_OBJECT_READY, changes the state to
+   * NamespaceState_OBJECT_READY_BUT_STALE . A stale Data packet does not match
+   * an Interest with MustBeFresh, and a new Data packet from setData (or from
+   * fetching the object again) replaces it.
+   * @return True if the attached Data packet is stale, false if it is fresh or
+   * there is no Data packet.
+   */
+  bool
+  getIsStale() { return impl_->getIsStale(); }
+
   /**
    * Get the validate state of this Namespace node. When a Namespace node is
    * first created, its validate state is
@@ -339,6 +449,28 @@ public:
     return impl_->setData(data);
   }
 
+  /**
+   * Attach each Data packet to the node for its name in this Namespace,
+   * creating the node if needed, as if calling setData for each one. Use this
+   * to publish many Data packets, such as the segments of an object. This
+   * first attaches all the Data packets, then checks them against the pending
+   * incoming Interests in one pass and sends the Data packets which satisfy
+   * them. The state change callbacks for created nodes are deferred until all
+   * the Data packets are attached, as with beginBatch.
+   * However, if getIsShutDown() then do nothing.
+   * @param dataList The Data packets. For efficiency, this does not copy the
+   * Data packet objects, as with setData.
+   * @return The number of Data packets attached. This does not count a Data
+   * packet for a node which already has a Data packet.
+   * @throws runtime_error if the name of this node is not a prefix of a Data
+   * packet name. In this case, no Data packets are attached.
+   */
+  size_t
+  addData(const std::vector<ndn::ptr_lib::shared_ptr<ndn::Data>>& dataList)
+  {
+    return impl_->addData(dataList);
+  }
+
   /**
    * Get the Data packet attached to this Namespace object. Note that
    * getObject() may be different than the content in the attached Data packet
@@ -412,9 +544,78 @@ public:
   uint64_t
   addOnStateChanged(const OnStateChanged& onStateChanged)
   {
-    return impl_->addOnStateChanged(onStateChanged);
+    return impl_->addOnStateChanged(onStateChanged, ALL_STATES, -1);
+  }
+
+  /**
+   * Add an onStateChanged callback which is only called for the given states
+   * and relative depth of the changed node. This is the same as
+   * addOnStateChanged(onStateChanged), except that the Namespace does not call
+   * onStateChanged for other changes, so the callback doesn't need to check
+   * and ignore them.
+   * @param onStateChanged The callback as described in
+   * addOnStateChanged(onStateChanged).
+   * @param stateMask The bitwise OR of getStateMask(state) for each state to
+   * report, or ALL_STATES.
+   * @param relativeDepth Only report a change of a node whose name has this
+   * many more components than this node, for example 0 for only this node
+   * or 1 for only the immediate children. If -1, report changes of this node
+   * and all children.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnStateChanged
+    (const OnStateChanged& onStateChanged, uint32_t stateMask,
+     int relativeDepth = -1)
+  {
+    return impl_->addOnStateChanged(onStateChanged, stateMask, relativeDepth);
+  }
+
+  /**
+   * Add an onStateChangedBatch callback. When the state changes in this
+   * namespace at this node or any children, this calls onStateChangedBatch
+   * with a list of the changed nodes. Outside of a batch (see beginBatch), the
+   * list has the one node whose state changed. When the outermost batch is
+   * committed, the list has each node whose state changed during the batch,
+   * once, in the order of its first change.
+   * @param onStateChangedBatch This calls
+   * onStateChangedBatch(namespace, changedNamespaces, callbackId) where
+   * namespace is this Namespace, changedNamespaces is the list of Namespace
+   * nodes (possibly children) whose state has changed, and callbackId is the
+   * callback ID returned by this method. Use getState() of each changed
+   * Namespace to get its state.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnStateChangedBatch(const OnStateChangedBatch& onStateChangedBatch)
+  {
+    return impl_->addOnStateChangedBatch(onStateChangedBatch);
   }
 
+  /**
+   * Begin a batch of state changes for the whole tree. Until the matching
+   * commitBatch(), a change of state of any node only updates the state, and
+   * the callbacks are deferred. Batches may be nested, and the callbacks are
+   * called when the outermost batch is committed. This is the same for any
+   * node in the tree.
+   */
+  void
+  beginBatch() { impl_->beginBatch(); }
+
+  /**
+   * Commit the batch started by beginBatch(). If this is the outermost batch,
+   * then for each node whose state changed during the batch, call the
+   * OnStateChanged callbacks of the node and its parents once with the final
+   * state of the node. Then call each OnStateChangedBatch callback of these
+   * nodes once with the list of its changed nodes.
+   * @throws runtime_error if there is no batch to commit.
+   */
+  void
+  commitBatch() { impl_->commitBatch(); }
+
   /**
    * Add an onValidateStateChanged callback. When the validate state changes in
    * this namespace at this node or any children, this calls
@@ -438,7 +639,32 @@ public:
   uint64_t
   addOnValidateStateChanged(const OnValidateStateChanged& onValidateStateChanged)
   {
-    return impl_->addOnValidateStateChanged(onValidateStateChanged);
+    return impl_->addOnValidateStateChanged
+      (onValidateStateChanged, ALL_STATES, -1);
+  }
+
+  /**
+   * Add an onValidateStateChanged callback which is only called for the given
+   * validate states and relative depth of the changed node. This is the same
+   * as addOnValidateStateChanged(onValidateStateChanged), except that the
+   * Namespace does not call onValidateStateChanged for other changes.
+   * @param onValidateStateChanged The callback as described in
+   * addOnValidateStateChanged(onValidateStateChanged).
+   * @param validateStateMask The bitwise OR of
+   * getValidateStateMask(validateState) for each validate state to report, or
+   * ALL_STATES.
+   * @param relativeDepth Only report a change of a node whose name has this
+   * many more components than this node. If -1, report changes of this node
+   * and all children.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnValidateStateChanged
+    (const OnValidateStateChanged& onValidateStateChanged,
+     uint32_t validateStateMask, int relativeDepth = -1)
+  {
+    return impl_->addOnValidateStateChanged
+      (onValidateStateChanged, validateStateMask, relativeDepth);
   }
 
   /**
@@ -502,6 +728,125 @@ public:
     impl_->setFace(face, onRegisterFailed, onRegisterSuccess);
   }
 
+  /**
+   * Register to receive Interest packets under this prefix from another Face
+   * and answer with Data packets from this Namespace tree, in addition to the
+   * Face from setFace. A pending Interest is answered on the Face it came
+   * from. This does not change the Face used by expressInterest.
+   * However, if getIsShutDown() then do nothing.
+   * @param face The Face object, which must remain valid until removeFace or
+   * shutdown.
+   * @param onRegisterFailed If register prefix fails for any reason, this
+   * calls onRegisterFailed(prefix).
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @param onRegisterSuccess (optional) This calls
+   * onRegisterSuccess(prefix, registeredPrefixId) when this receives a success
+   * message from the forwarder. If onRegisterSuccess is an empty
+   * OnRegisterSuccess(), this does not use it.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @throws runtime_error if the face was already added to this node.
+   */
+  void
+  addFace
+    (ndn::Face* face, const ndn::OnRegisterFailed& onRegisterFailed,
+     const ndn::OnRegisterSuccess& onRegisterSuccess = ndn::OnRegisterSuccess())
+  {
+    impl_->addFace(face, onRegisterFailed, onRegisterSuccess);
+  }
+
+  /**
+   * Unregister the prefix on a Face from addFace. If no other node uses the
+   * Face to receive Interests, remove its pending Interests and its counters.
+   * If the face was not added to this node, do nothing.
+   * @param face The Face object given to addFace.
+   */
+  void
+  removeFace(ndn::Face* face) { impl_->removeFace(face); }
+
+  /**
+   * Get the number of Interests which objectNeeded expressed and which have
+   * not received a Data packet, timeout or network Nack. If objectNeeded is
+   * called for a node whose Interest is in flight, it does not express
+   * another Interest (unless the new request has mustBeFresh and the Interest
+   * in flight does not), and the response updates the node's state for all
+   * requests. This is the same for any node in the tree.
+   * @return The number of Interests in flight.
+   */
+  size_t
+  getNInFlightInterests() { return impl_->getNInFlightInterests(); }
+
+  /**
+   * Get the total number of objectNeeded requests which were coalesced with an
+   * Interest in flight, as described in getNInFlightInterests. This is the
+   * same for any node in the tree.
+   * @return The number of coalesced requests.
+   */
+  uint64_t
+  getNCoalescedInterests() { return impl_->getNCoalescedInterests(); }
+
+  /**
+   * Get the total number of objectNeeded requests which were answered from the
+   * negative cache, as described in setNegativeCacheTtl. This is the same for
+   * any node in the tree.
+   * @return The number of negative cache hits.
+   */
+  uint64_t
+  getNNegativeCacheHits() { return impl_->getNNegativeCacheHits(); }
+
+  /**
+   * Get the smoothed round-trip time of Interests expressed by objectNeeded,
+   * as described in RFC 6298. This does not measure a Data packet which
+   * answers a re-expressed Interest. This is the same for any node in the
+   * tree.
+   * @return The smoothed round-trip time, or a negative value if there is no
+   * measurement yet.
+   */
+  std::chrono::nanoseconds
+  getSmoothedRtt() { return impl_->getSmoothedRtt(); }
+
+  /**
+   * Get the round-trip time variation of Interests expressed by objectNeeded,
+   * as described in getSmoothedRtt.
+   * @return The round-trip time variation, or a negative value if there is no
+   * measurement yet.
+   */
+  std::chrono::nanoseconds
+  getRttVariation() { return impl_->getRttVariation(); }
+
+  /**
+   * Get the retransmission timeout computed from the smoothed round-trip time
+   * and variation, as described in RFC 6298. objectNeeded uses this as the
+   * Interest lifetime, and on timeout re-expresses the Interest with double
+   * the lifetime until it would exceed the maximum Interest lifetime (see
+   * setMaxInterestLifetime), calling the OnInterestRetransmitted callbacks
+   * (see addOnInterestRetransmitted). A timeout doubles the retransmission
+   * timeout, but only once
+   * for the Interests which were sent before the last doubling, and the next
+   * measurement cancels the backoff. This is the same for any node in the
+   * tree.
+   * @return The retransmission timeout.
+   */
+  std::chrono::nanoseconds
+  getRetransmissionTimeout() { return impl_->getRetransmissionTimeout(); }
+
+  /**
+   * Get the counts of packets for a Face which receives Interests for this
+   * Namespace tree, from setFace or addFace. This is the same for any node in
+   * the tree.
+   * @param face The Face object.
+   * @return A copy of the FaceCounters. If the Face has not received an
+   * Interest, the counts are zero.
+   */
+  FaceCounters
+  getFaceCounters(const ndn::Face* face)
+  {
+    return impl_->getFaceCounters(face);
+  }
+
   /**
    * Set the KeyChain used to sign packets (if needed) at this or child nodes.
    * If a KeyChain already exists at this node, it is replaced.
@@ -560,11 +905,24 @@ public:
   void
   objectNeeded(bool mustBeFresh = false) { impl_->objectNeeded(mustBeFresh); }
 
+  /**
+   * If this node has an Interest in flight from objectNeeded, express it again
+   * now with a new nonce instead of waiting for it to time out. For example, a
+   * fetcher calls this when later Data packets arrive but not the one for this
+   * node, so that the Interest or its Data was probably lost. A Data packet
+   * for the earlier Interest is still accepted, but its timeout is ignored.
+   * However, if getIsShutDown() then do nothing.
+   * @return True if this expressed the Interest, or false if this node has no
+   * Interest in flight.
+   */
+  bool
+  reExpressInterest() { return impl_->reExpressInterest(); }
+
   /**
    * Set the maximum lifetime for re-expressed interests to be used when this or
    * a child node calls expressInterest. You can call this on a child node to
    * set a different maximum lifetime. If you don't set this, the default is
-   * std::chrono::milliseconds(-1).
+   * std::chrono::milliseconds(-1) which uses a maximum of 16 seconds.
    * @param maxInterestLifetime The maximum lifetime in nanoseconds.
    */
   void
@@ -573,6 +931,39 @@ public:
     impl_->setMaxInterestLifetime(maxInterestLifetime);
   }
 
+  /**
+   * Set the time to live of negative cache entries for this or a child node.
+   * When the Interest expressed by objectNeeded times out or gets a network
+   * Nack, the node remembers the failure. If objectNeeded is called again for
+   * the node before the entry expires (and no OnObjectNeeded callback can
+   * produce the object), this does not express an Interest but sets the state
+   * again to NamespaceState_INTEREST_TIMEOUT or
+   * NamespaceState_INTEREST_NETWORK_NACK, from a callLater on the Face so that
+   * the state change callbacks are not called from inside objectNeeded. The
+   * time to live is multiplied by 4 for a Nack with reason NO_ROUTE and by 0.5
+   * for reason CONGESTION. A Nack with reason DUPLICATE is not cached. Each
+   * consecutive failure for the node doubles the time to live, up to 64 times,
+   * and receiving a Data packet resets it. You can call this on a child node
+   * to set a different time to live. If you don't set this, the default is
+   * std::chrono::nanoseconds(-1) which disables the negative cache.
+   * @param negativeCacheTtl The time to live in nanoseconds, or a negative
+   * value to disable the negative cache.
+   */
+  void
+  setNegativeCacheTtl(std::chrono::nanoseconds negativeCacheTtl)
+  {
+    impl_->setNegativeCacheTtl(negativeCacheTtl);
+  }
+
+  /**
+   * Clear the negative cache entry of this node (see setNegativeCacheTtl) and
+   * reset its backoff, so that the next call to objectNeeded expresses an
+   * Interest. For example, a fetcher calls this before it retries an Interest
+   * which failed. This does not change the state.
+   */
+  void
+  clearNegativeCacheEntry() { impl_->clearNegativeCacheEntry(); }
+
   /**
    * Remove the callback with the given callbackId. This does not search for the
    * callbackId in child nodes. If the callbackId isn't found, do nothing.
@@ -606,6 +997,295 @@ public:
   bool
   getIsShutDown() { return impl_->getIsShutDown(); }
 
+  /**
+   * Get the number of nodes in the tree below the root. The root node
+   * allocates the storage of all other nodes in bulk from its node pool. This
+   * is the same for any node in the tree.
+   * @return The number of nodes, not counting the root.
+   */
+  size_t
+  getNNodes() { return impl_->getNNodes(); }
+
+  /**
+   * Get the number of bytes that the root's node pool has handed out for the
+   * nodes below the root (not counting the name, Data, object and callbacks
+   * of each node). This is the same for any node in the tree. For example,
+   * getNodeStorageBytes() / getNNodes() is the average storage cost of a node.
+   * @return The number of bytes.
+   */
+  size_t
+  getNodeStorageBytes() { return impl_->getNodeStorageBytes(); }
+
+  /**
+   * Get the number of calls to the system allocator that the root's node pool
+   * has made. This grows by one for each slab of many nodes instead of by
+   * several for each node. This is the same for any node in the tree.
+   * @return The number of system allocations.
+   */
+  size_t
+  getNNodeStorageAllocations() { return impl_->getNNodeStorageAllocations(); }
+
+  /**
+   * Set the memory budget for the Data packets and objects held by all nodes
+   * in the tree. This is the same for any node in the tree. When the payload
+   * bytes exceed the budget, evict the Data packet and object of the least
+   * recently used nodes (a node is used when its Data or object is set, or
+   * when it satisfies an Interest or objectNeeded) until the payload bytes are
+   * within the budget. An evicted node silently returns to the state
+   * NamespaceState_NAME_EXISTS so that a later objectNeeded() fetches it again.
+   * This does not evict a node whose Data or object is in flight, which is a
+   * state of INTEREST_EXPRESSED, DESERIALIZING, DECRYPTING, PRODUCING_OBJECT,
+   * SERIALIZING, ENCRYPTING or SIGNING.
+   * @param maxPayloadBytes The maximum number of payload bytes, or 0 for no
+   * limit (the default).
+   * @param removeEmptyNodes (optional) If true, after evicting a node, remove
+   * it from its parent if it has no children, no callbacks and no settings such
+   * as a Face, then do the same for the parent. Only set this true if the
+   * application does not keep a reference to such nodes. If omitted, don't
+   * remove nodes.
+   */
+  void
+  setMaxPayloadBytes(size_t maxPayloadBytes, bool removeEmptyNodes = false)
+  {
+    impl_->setMaxPayloadBytes(maxPayloadBytes, removeEmptyNodes);
+  }
+
+  /**
+   * Get the number of bytes of the Data packets and objects held by all nodes
+   * in the tree, as counted for setMaxPayloadBytes. A Data packet counts as the
+   * size of its wire encoding. A BlobObject counts as the size of its Blob,
+   * unless it shares the content of the node's Data packet. This is the same
+   * for any node in the tree.
+   * @return The number of payload bytes.
+   */
+  size_t
+  getPayloadBytes() { return impl_->getPayloadBytes(); }
+
+  /**
+   * Get the number of bytes of the Data packet and object held by this node,
+   * counted as described in getPayloadBytes().
+   * @return The number of payload bytes of this node.
+   */
+  size_t
+  getNodePayloadBytes() { return impl_->getNodePayloadBytes(); }
+
+  /**
+   * Get the total number of payload bytes that have been evicted because of
+   * the budget of setMaxPayloadBytes. This is the same for any node in the tree.
+   * @return The number of evicted bytes.
+   */
+  size_t
+  getNEvictedPayloadBytes() { return impl_->getNEvictedPayloadBytes(); }
+
+  /**
+   * Add an onEvicted callback which is called when the Data packet and object
+   * of a node in the tree are evicted because of the budget of
+   * setMaxPayloadBytes. The callback is kept by the root node, so this is the
+   * same for any node in the tree.
+   * @param onEvicted This calls
+   * onEvicted(namespace, evictedNamespace, nBytes, callbackId) where namespace
+   * is the root Namespace, evictedNamespace is the node whose payload was
+   * evicted, nBytes is the number of evicted payload bytes, and callbackId is
+   * the callback ID returned by this method.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnEvicted(const OnEvicted& onEvicted)
+  {
+    return impl_->addOnEvicted(onEvicted);
+  }
+
+  /**
+   * Add an onInterestRetransmitted callback which is called when a node in the
+   * tree re-expresses the Interest from objectNeeded because the previous
+   * Interest timed out (see getRetransmissionTimeout). For example, a fetcher
+   * can use this to react to each timeout instead of waiting for the final
+   * NamespaceState_INTEREST_TIMEOUT. The callback is kept by the root node, so
+   * this is the same for any node in the tree.
+   * @param onInterestRetransmitted This calls
+   * onInterestRetransmitted(namespace, retransmittedNamespace, callbackId)
+   * where namespace is the root Namespace, retransmittedNamespace is the node
+   * which re-expressed the Interest, and callbackId is the callback ID
+   * returned by this method.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnInterestRetransmitted
+    (const OnInterestRetransmitted& onInterestRetransmitted)
+  {
+    return impl_->addOnInterestRetransmitted(onInterestRetransmitted);
+  }
+
+  /**
+   * Release the Data packet and object of this node to free memory, for
+   * example after the application has consumed a segment. As when evicted
+   * because of the budget of setMaxPayloadBytes, the node silently returns to
+   * the state NamespaceState_NAME_EXISTS so that a later objectNeeded()
+   * fetches it again. However, this does not call the OnEvicted callbacks or
+   * remove the node. If the Data or object of this node is in flight (as
+   * described in setMaxPayloadBytes), or if getIsShutDown(), then do nothing.
+   */
+  void
+  releasePayload() { impl_->releasePayload(); }
+
+  /**
+   * Call releasePayload() from a callLater on the Face, so that the callbacks
+   * for the current state change of this node still see its Data and object.
+   * For example, an OnSegment callback can call this after consuming the
+   * segment. After releasing, this also removes the node from its parent if it
+   * has no payload, children, callbacks or settings (as for setMaxPayloadBytes
+   * with removeEmptyNodes), so you must not use a reference to this Namespace
+   * object after this call. If a Face has not been set for this or a parent,
+   * or if getIsShutDown(), then do nothing.
+   */
+  void
+  releasePayloadLater() { impl_->releasePayloadLater(); }
+
+  /**
+   * Set whether to fetch (or produce) the object again when the freshness
+   * period of its Data packet ends, by calling objectNeeded(true) on the node
+   * after changing its state to NamespaceState_OBJECT_READY_BUT_STALE . This
+   * is the same for any node in the tree. This does not fetch again if the
+   * node is already fetching or producing the object.
+   * @param refetchStaleObjects True to fetch stale objects again. The default
+   * is false.
+   */
+  void
+  setRefetchStaleObjects(bool refetchStaleObjects)
+  {
+    impl_->setRefetchStaleObjects(refetchStaleObjects);
+  }
+
+  /**
+   * Set the maximum number of speculative nodes. When an incoming Interest
+   * does not match a Data packet and its name does not have a node, the
+   * default OnInterest handler creates the node only if an OnObjectNeeded
+   * callback on a parent may claim it. The node is speculative until a
+   * callback claims it, when the new nodes are reported with
+   * NamespaceState_NAME_EXISTS . If no callback claims it, the nodes are
+   * removed again, or if a callback still uses them, the node stays
+   * speculative until the Interest times out. If the maximum is reached, the
+   * OnObjectNeeded callbacks are not called and the Interest is dropped. This
+   * is the same for any node in the tree.
+   * @param maxSpeculativeNodes The maximum number of speculative nodes. The
+   * default is 10000.
+   */
+  void
+  setMaxSpeculativeNodes(size_t maxSpeculativeNodes)
+  {
+    impl_->setMaxSpeculativeNodes(maxSpeculativeNodes);
+  }
+
+  /**
+   * Get the number of speculative nodes as described in setMaxSpeculativeNodes.
+   * This is the same for any node in the tree.
+   * @return The number of speculative nodes.
+   */
+  size_t
+  getNSpeculativeNodes() { return impl_->getNSpeculativeNodes(); }
+
+  /**
+   * Get the number of Interests which were received by the registered prefix
+   * and are waiting for a Data packet. This is the same for any node in the
+   * tree.
+   * @return The number of pending incoming Interests.
+   */
+  size_t
+  getNPendingIncomingInterests()
+  {
+    return impl_->getNPendingIncomingInterests();
+  }
+
+  /**
+   * Get the largest number of pending incoming Interests at one time, as
+   * described in getNPendingIncomingInterests.
+   * @return The high-water mark.
+   */
+  size_t
+  getPendingIncomingInterestsHighWaterMark()
+  {
+    return impl_->getPendingIncomingInterestsHighWaterMark();
+  }
+
+  /**
+   * Set the maximum number of pending incoming Interests, as described in
+   * getNPendingIncomingInterests, and the policy for an Interest which arrives
+   * when the maximum is reached. With IncomingInterestOverloadPolicy_DROP_OLDEST
+   * the oldest pending Interest is removed (and reported to
+   * OnIncomingInterestTimeout callbacks). With
+   * IncomingInterestOverloadPolicy_REJECT_NEW the new Interest is ignored, and
+   * with IncomingInterestOverloadPolicy_NACK a Nack with reason CONGESTION is
+   * sent for it. A rejected Interest does not call OnObjectNeeded callbacks.
+   * This is the same for any node in the tree.
+   * @param maxPendingIncomingInterests The maximum number of pending incoming
+   * Interests, or 0 for no limit. The default is 0.
+   * @param overloadPolicy (optional) The IncomingInterestOverloadPolicy. If
+   * omitted, use IncomingInterestOverloadPolicy_DROP_OLDEST.
+   */
+  void
+  setMaxPendingIncomingInterests
+    (size_t maxPendingIncomingInterests,
+     IncomingInterestOverloadPolicy overloadPolicy =
+       IncomingInterestOverloadPolicy_DROP_OLDEST)
+  {
+    impl_->setMaxPendingIncomingInterests
+      (maxPendingIncomingInterests, overloadPolicy);
+  }
+
+  /**
+   * Add an OnIncomingInterestTimeout callback which is called when a pending
+   * incoming Interest for the name of this node or a child times out (or is
+   * dropped by setMaxPendingIncomingInterests) before a Data packet satisfies
+   * it. A producer can use this to cancel the work to produce the object.
+   * @param onIncomingInterestTimeout This calls
+   * onIncomingInterestTimeout(nameSpace, interestNamespace, interest, callbackId)
+   * where nameSpace is this Namespace, interestNamespace is the node with the
+   * Interest name (or the nearest existing parent node if it was not created),
+   * interest is the pending Interest and callbackId is the callback ID
+   * returned by this method. NOTE: The library will log any exceptions thrown
+   * by this callback, but for better error handling the callback should catch
+   * and properly handle any exceptions.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnIncomingInterestTimeout
+    (const OnIncomingInterestTimeout& onIncomingInterestTimeout)
+  {
+    return impl_->addOnIncomingInterestTimeout(onIncomingInterestTimeout);
+  }
+
+  /**
+   * Get the bit for the state to use in the stateMask of addOnStateChanged.
+   * @param state The NamespaceState.
+   * @return The mask bit. You can combine mask bits with bitwise OR.
+   */
+  static uint32_t
+  getStateMask(NamespaceState state) { return (uint32_t)1 << state; }
+
+  /**
+   * Get the bit for the validate state to use in the validateStateMask of
+   * addOnValidateStateChanged.
+   * @param validateState The NamespaceValidateState.
+   * @return The mask bit. You can combine mask bits with bitwise OR.
+   */
+  static uint32_t
+  getValidateStateMask(NamespaceValidateState validateState)
+  {
+    return (uint32_t)1 << validateState;
+  }
+
+  /**
+   * The state mask for addOnStateChanged and addOnValidateStateChanged to
+   * report all states.
+   */
+  static const uint32_t ALL_STATES = 0xffffffff;
+
   /**
    * Get the next unique callback ID. This uses an atomic_uint64_t to be thread
    * safe. This is an internal method only meant to be called by library
@@ -712,15 +1392,20 @@ public:
      * Create a new Impl, which should belong to a shared_ptr.
      * @param outerNamespace The Namespace which is creating this inner Imp.
      * @param name See the Namespace constructor.
-     * @param isShutDown The isShutDown flag from the root (or a new bool(false)
-     * if this is the root).
+     * @param isShutDown The isShutDown flag from the root, or null if this is
+     * the root, in which case this creates the flag and the RootState.
      */
     Impl
       (Namespace& outerNamespace, const ndn::Name& name, ndn::KeyChain* keyChain,
        const ndn::ptr_lib::shared_ptr<bool>& isShutDown);
 
-    const ndn::Name&
-    getName() const { return name_; }
+    ~Impl();
+
+    ndn::Name
+    getName() const { return parent_ ? buildName() : name_; }
+
+    const ndn::Name::Component&
+    getNameComponent() const { return component_; }
 
     Namespace*
     getParent();
@@ -746,6 +1431,28 @@ public:
     const std::string&
     getSigningError() { return signingError_; }
 
+    /**
+     * ComponentHash is the hash function for the children_ index. It hashes
+     * the bytes of the component value with FNV-1a, which is fast for the
+     * short segment and sequence number components that dominate large trees.
+     */
+    class ComponentHash {
+    public:
+      size_t
+      operator() (const ndn::Name::Component& component) const
+      {
+        const ndn::Blob& value = component.getValue();
+        const uint8_t* buf = value.buf();
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < value.size(); ++i) {
+          hash ^= buf[i];
+          hash *= 1099511628211ULL;
+        }
+
+        return (size_t)hash;
+      }
+    };
+
     bool
     hasChild(const ndn::Name::Component& component) const
     {
@@ -758,8 +1465,7 @@ public:
     Namespace&
     getChild(const ndn::Name::Component& component)
     {
-      std::map<ndn::Name::Component, ndn::ptr_lib::shared_ptr<Namespace>>::iterator
-        child = children_.find(component);
+      ChildMap::iterator child = children_.find(component);
       if (child != children_.end())
         return *child->second;
       else
@@ -784,6 +1490,9 @@ public:
     bool
     setData(const ndn::ptr_lib::shared_ptr<ndn::Data>& data);
 
+    size_t
+    addData(const std::vector<ndn::ptr_lib::shared_ptr<ndn::Data>>& dataList);
+
     const ndn::ptr_lib::shared_ptr<ndn::Data>&
     getData() { return data_; }
 
@@ -794,11 +1503,14 @@ public:
     getObject() { return object_; }
 
     uint64_t
-    addOnStateChanged(const OnStateChanged& onStateChanged);
+    addOnStateChanged
+      (const OnStateChanged& onStateChanged, uint32_t stateMask,
+       int relativeDepth);
 
     uint64_t
     addOnValidateStateChanged
-      (const OnValidateStateChanged& onValidateStateChanged);
+      (const OnValidateStateChanged& onValidateStateChanged,
+       uint32_t validateStateMask, int relativeDepth);
 
     uint64_t
     addOnObjectNeeded(const OnObjectNeeded& onObjectNeeded);
@@ -809,19 +1521,80 @@ public:
        const ndn::OnRegisterSuccess& onRegisterSuccess);
 
     void
-    setKeyChain(ndn::KeyChain* keyChain) { keyChain_ = keyChain; }
+    addFace
+      (ndn::Face* face, const ndn::OnRegisterFailed& onRegisterFailed,
+       const ndn::OnRegisterSuccess& onRegisterSuccess);
 
     void
-    enableSync(int depth);
+    removeFace(ndn::Face* face);
 
-    void
-    setNewDataMetaInfo(const ndn::MetaInfo& metaInfo)
-    {
-      newDataMetaInfo_ = ndn::ptr_lib::make_shared<ndn::MetaInfo>(metaInfo);
+    FaceCounters
+    getFaceCounters(const ndn::Face* face);
+
+    size_t
+    getNInFlightInterests();
+
+    uint64_t
+    getNCoalescedInterests();
+
+    uint64_t
+    getNNegativeCacheHits() { return getRootState().nNegativeCacheHits_; }
+
+    std::chrono::nanoseconds
+    getSmoothedRtt();
+
+    std::chrono::nanoseconds
+    getRttVariation();
+
+    std::chrono::nanoseconds
+    getRetransmissionTimeout();
+
+    /**
+     * Remove this node from the root's OutgoingInterestTable because its
+     * Interest got a response.
+     */
+    void
+    removeOutgoingInterest();
+
+    /**
+     * Unregister the prefix on each Face from addFace and clear addedFaces_.
+     */
+    void
+    removeAddedFaces();
+
+    /**
+     * Unregister the prefix on the face and remove the face from the
+     * PendingIncomingInterestTable, which removes its pending Interests when
+     * no other registration uses it.
+     * @param face The Face from setFace or addFace.
+     * @param registeredPrefixId The registered prefix ID.
+     */
+    void
+    unregisterFace(ndn::Face* face, uint64_t registeredPrefixId);
+
+    void
+    setKeyChain(ndn::KeyChain* keyChain)
+    {
+      keyChain_ = keyChain;
+      invalidateInheritedSettings();
+    }
+
+    void
+    enableSync(int depth);
+
+    void
+    setNewDataMetaInfo(const ndn::MetaInfo& metaInfo)
+    {
+      newDataMetaInfo_ = ndn::ptr_lib::make_shared<ndn::MetaInfo>(metaInfo);
+      invalidateInheritedSettings();
     }
 
     void
-    setDecryptor(ndn::DecryptorV2* decryptor) { decryptor_ = decryptor; }
+    setDecryptor(ndn::DecryptorV2* decryptor)
+    {
+      decryptor_ = decryptor;
+      invalidateInheritedSettings();
+    }
 
     ndn::KeyChain*
     getKeyChain_();
@@ -836,10 +1609,28 @@ public:
     void
     objectNeeded(bool mustBeFresh);
 
+    bool
+    reExpressInterest();
+
     void
     setMaxInterestLifetime(std::chrono::nanoseconds maxInterestLifetime)
     {
       maxInterestLifetime_ = maxInterestLifetime;
+      invalidateInheritedSettings();
+    }
+
+    void
+    setNegativeCacheTtl(std::chrono::nanoseconds negativeCacheTtl)
+    {
+      negativeCacheTtl_ = negativeCacheTtl;
+      invalidateInheritedSettings();
+    }
+
+    void
+    clearNegativeCacheEntry()
+    {
+      negativeCacheExpiryTime_ = std::chrono::system_clock::time_point::min();
+      nNegativeCacheFailures_ = 0;
     }
 
     void
@@ -849,7 +1640,13 @@ public:
     experimentalClear()
     {
       object_.reset();
+      // Remove the Data packets of the children from the count in this and
+      // parent nodes.
+      updateNDataNodes(-(int)(nDataNodes_ - (data_ ? 1 : 0)));
       children_.clear();
+      sortedChildren_.clear();
+      isSortedChildrenValid_ = true;
+      updatePayload();
     }
 
     void
@@ -879,10 +1676,545 @@ public:
         return;
 
       object_ = object;
+      updatePayload();
       setState(NamespaceState_OBJECT_READY);
     }
 
+    size_t
+    getNNodes();
+
+    size_t
+    getNodeStorageBytes();
+
+    size_t
+    getNNodeStorageAllocations();
+
+    void
+    setMaxPayloadBytes(size_t maxPayloadBytes, bool removeEmptyNodes)
+    {
+      getRootState().maxPayloadBytes_ = maxPayloadBytes;
+      getRootState().removeEmptyNodes_ = removeEmptyNodes;
+      root_->evictPayloads(0);
+    }
+
+    size_t
+    getPayloadBytes() { return getRootState().totalPayloadBytes_; }
+
+    size_t
+    getNodePayloadBytes() { return payloadBytes_; }
+
+    size_t
+    getNEvictedPayloadBytes()
+    {
+      return getRootState().nEvictedPayloadBytes_;
+    }
+
+    uint64_t
+    addOnEvicted(const OnEvicted& onEvicted);
+
+    uint64_t
+    addOnInterestRetransmitted
+      (const OnInterestRetransmitted& onInterestRetransmitted);
+
+    void
+    releasePayload();
+
+    void
+    releasePayloadLater();
+
+    bool
+    getIsStale() { return isStale_; }
+
+    void
+    setRefetchStaleObjects(bool refetchStaleObjects)
+    {
+      getRootState().refetchStaleObjects_ = refetchStaleObjects;
+    }
+
+    void
+    setMaxSpeculativeNodes(size_t maxSpeculativeNodes)
+    {
+      getRootState().maxSpeculativeNodes_ = maxSpeculativeNodes;
+    }
+
+    size_t
+    getNSpeculativeNodes()
+    {
+      const RootState& rootState = *root_->rootState_;
+      return rootState.nSpeculativeNodes_ ? *rootState.nSpeculativeNodes_ : 0;
+    }
+
+    size_t
+    getNPendingIncomingInterests();
+
+    size_t
+    getPendingIncomingInterestsHighWaterMark();
+
+    void
+    setMaxPendingIncomingInterests
+      (size_t maxPendingIncomingInterests,
+       IncomingInterestOverloadPolicy overloadPolicy);
+
+    uint64_t
+    addOnIncomingInterestTimeout
+      (const OnIncomingInterestTimeout& onIncomingInterestTimeout);
+
+    uint64_t
+    addOnStateChangedBatch(const OnStateChangedBatch& onStateChangedBatch);
+
+    void
+    beginBatch() { ++getRootState().batchDepth_; }
+
+    void
+    commitBatch();
+
+    /**
+     * This is called by the Namespace destructor. A callback may still hold
+     * this Impl, so remove it from the payload list and the outgoing Interest
+     * table, and set isDeleted_ so that outerNamespace_ and the root are not
+     * used.
+     */
+    void
+    onNamespaceDeleted()
+    {
+      unlinkPayload();
+      removeOutgoingInterest();
+      isDeleted_ = true;
+    }
+
   private:
+    typedef std::unordered_map
+      <ndn::Name::Component, ndn::ptr_lib::shared_ptr<Namespace>, ComponentHash>
+      ChildMap;
+
+    /**
+     * A FilteredCallback holds a callback with the mask of states and the
+     * relative depth of the changed node for which to call it.
+     */
+    template<class Callback>
+    class FilteredCallback {
+    public:
+      FilteredCallback()
+      : stateMask_(0), relativeDepth_(-1)
+      {}
+
+      FilteredCallback
+        (const Callback& callback, uint32_t stateMask, int relativeDepth)
+      : callback_(callback), stateMask_(stateMask),
+        relativeDepth_(relativeDepth)
+      {}
+
+      const Callback&
+      getCallback() const { return callback_; }
+
+      uint32_t
+      getStateMask() const { return stateMask_; }
+
+      /**
+       * Check if the callback should be called for the change.
+       * @param stateMask The mask bit of the new state.
+       * @param relativeDepth The depth of the changed node minus the depth of
+       * the node with the callback.
+       * @return True if the callback matches.
+       */
+      bool
+      matches(uint32_t stateMask, size_t relativeDepth) const
+      {
+        return (stateMask_ & stateMask) != 0 &&
+          (relativeDepth_ < 0 || (size_t)relativeDepth_ == relativeDepth);
+      }
+
+    private:
+      Callback callback_;
+      uint32_t stateMask_;
+      int relativeDepth_;
+    };
+
+    /**
+     * Update onStateChangedStateMask_ and onValidateStateChangedStateMask_ from
+     * the callbacks. This is called after adding or removing a callback.
+     */
+    void
+    updateStateMasks();
+
+    /**
+     * The kinds of callbacks for which a node caches the nearest node with
+     * callbacks of that kind.
+     */
+    enum ListenerKind {
+      LISTENER_STATE_CHANGED = 0,
+      LISTENER_VALIDATE_STATE_CHANGED,
+      LISTENER_STATE_CHANGED_BATCH,
+      LISTENER_OBJECT_NEEDED,
+      LISTENER_DESERIALIZE_NEEDED,
+      LISTENER_INCOMING_INTEREST_TIMEOUT,
+      N_LISTENER_KINDS
+    };
+
+    /**
+     * Check if this node has callbacks of the kind.
+     * @param kind The ListenerKind.
+     * @return True if this node has callbacks of the kind.
+     */
+    bool
+    hasListeners(ListenerKind kind) const;
+
+    /**
+     * Increment the listeners epoch in the root node so that every node
+     * resolves its nearest listeners again. Call this when a callback registry
+     * changes from empty to not empty or back.
+     */
+    void
+    invalidateNearestListeners() { ++getRootState().listenersEpoch_; }
+
+    /**
+     * Get this or the nearest parent node which has callbacks of the kind,
+     * resolving the nearest listeners of this node if they were invalidated.
+     * @param kind The ListenerKind.
+     * @return The nearest listener node, or null if none.
+     */
+    Namespace::Impl*
+    getNearestListener(ListenerKind kind)
+    {
+      if (nearestListenersEpoch_ != getRootState().listenersEpoch_)
+        resolveNearestListeners();
+      return nearestListener_[kind];
+    }
+
+    /**
+     * Get the nearest listener node of the kind above this node, to continue
+     * a walk from getNearestListener().
+     * @param kind The ListenerKind.
+     * @return The nearest listener node of the parent, or null if none.
+     */
+    Namespace::Impl*
+    getNextListener(ListenerKind kind)
+    {
+      return parent_ ? parent_->getNearestListener(kind) : 0;
+    }
+
+    void
+    resolveNearestListeners();
+
+    /**
+     * Make pendingIncomingInterestTable_ in the root node if it doesn't exist.
+     */
+    void
+    createPendingIncomingInterestTable();
+
+    /**
+     * Set data_ and the fields which depend on it. The caller has checked that
+     * this node can take the Data packet and has sent it to the pending
+     * incoming Interests.
+     * @param data The Data packet.
+     * @param wireEncoding The wire encoding of the Data packet.
+     * @param nowTimePoint The current time, for the freshness expiry time.
+     */
+    void
+    attachData
+      (const ndn::ptr_lib::shared_ptr<ndn::Data>& data,
+       const ndn::Blob& wireEncoding,
+       std::chrono::system_clock::time_point nowTimePoint);
+
+    /**
+     * This is called by the PendingIncomingInterestTable when a pending
+     * Interest times out or is dropped. Call the OnIncomingInterestTimeout
+     * callbacks of the node for the Interest name and its parents.
+     * @param interest The unsatisfied Interest.
+     */
+    void
+    onIncomingInterestUnsatisfied
+      (const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest);
+
+    void
+    fireOnIncomingInterestTimeout
+      (Namespace& interestNamespace,
+       const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest);
+
+    /**
+     * Make the full name of this node from the components of this and parent
+     * nodes.
+     * @return A new Name.
+     */
+    ndn::Name
+    buildName() const;
+
+    /**
+     * Check if the name of this node is a prefix of the given name, comparing
+     * the components by position without building the name of this node.
+     * @param name The name to check.
+     * @return True if the name of this node is a prefix of name.
+     */
+    bool
+    isPrefixOfName(const ndn::Name& name) const;
+
+    /**
+     * Check if the name of this node equals the given name, without building
+     * the name of this node.
+     * @param name The name to check.
+     * @return True if the names are equal.
+     */
+    bool
+    nameEquals(const ndn::Name& name) const
+    {
+      return name.size() == depth_ && isPrefixOfName(name);
+    }
+
+    /**
+     * Get the children of this node sorted by name component. The sorted list
+     * is only rebuilt if a child was added out of order since the last call, so
+     * only use this where iteration order matters.
+     * @return The sorted list of child Impl objects. This is invalidated when
+     * a child is added.
+     */
+    const std::vector<Namespace::Impl*>&
+    getSortedChildren();
+
+    /**
+     * Increment the settings epoch in the root node so that every node resolves
+     * its inherited settings again on the next call to a getter such as
+     * getFace_(). Call this whenever a setting which children inherit is changed.
+     */
+    void
+    invalidateInheritedSettings() { ++getRootState().settingsEpoch_; }
+
+    /**
+     * If the inherited settings of this node were resolved before the last call
+     * to invalidateInheritedSettings(), then resolve them again from the settings
+     * of this node and the (updated) inherited settings of the parent.
+     */
+    void
+    updateInheritedSettings()
+    {
+      if (inheritedSettingsEpoch_ != getRootState().settingsEpoch_)
+        resolveInheritedSettings();
+    }
+
+    void
+    resolveInheritedSettings();
+
+    /**
+     * Add delta to nDataNodes_ of this and all parent nodes. If delta is
+     * positive (because data_ is set on this node), also raise maxDataDepth_
+     * to depth_ where it is less.
+     * @param delta The change in the number of nodes with a Data packet.
+     */
+    void
+    updateNDataNodes(int delta);
+
+    /**
+     * If this node is in the root's payload list, remove it and subtract its
+     * payload bytes from the total in the root node.
+     */
+    void
+    unlinkPayload();
+
+    /**
+     * Unlink the payload and clear data_ and object_ with their freshness, and
+     * silently set the state to NAME_EXISTS. This is used by evictPayloads and
+     * releasePayload.
+     */
+    void
+    clearPayload();
+
+    /**
+     * Count the bytes of data_ and object_ as described in getPayloadBytes(),
+     * update the totals in the root node, and move this node to the most
+     * recently used end of the root's payload list (or remove it from the list
+     * if it has no payload). Then evict other nodes if over the budget.
+     */
+    void
+    updatePayload();
+
+    /**
+     * If this node is in the root's payload list, move it to the most recently
+     * used end.
+     */
+    void
+    touchPayload();
+
+    /**
+     * This is called on the root node to evict the payload of the least
+     * recently used nodes until the payload bytes are within maxPayloadBytes_.
+     * @param keepNode Don't evict this node, which is the one being updated. This
+     * may be null.
+     */
+    void
+    evictPayloads(Namespace::Impl* keepNode);
+
+    /**
+     * Check if the state shows that the Data or object of this node is in
+     * flight, so that evictPayloads must not evict it.
+     */
+    bool
+    isPayloadInFlight() const;
+
+    /**
+     * Remove this node from its parent if it has no payload, children,
+     * callbacks or settings, then do the same for the parent.
+     * @param stopNode Stop when reaching this node without removing it. If
+     * null, continue up to the root.
+     */
+    void
+    removeIfEmpty(Namespace::Impl* stopNode);
+
+    /**
+     * This is called by callLater from releasePayloadLater to release the
+     * payload and remove this node if it is empty, unless this node was
+     * deleted in the meantime.
+     */
+    void
+    releaseAndRemovePayload();
+
+    /**
+     * If this node is speculative (see Namespace::setMaxSpeculativeNodes),
+     * decrement the count in the root and make it not speculative.
+     */
+    void
+    clearSpeculative()
+    {
+      if (speculativeNodeCount_) {
+        --*speculativeNodeCount_;
+        speculativeNodeCount_.reset();
+      }
+    }
+
+    void
+    fireOnEvicted(Namespace& evictedNamespace, size_t nBytes);
+
+    /**
+     * Call the OnInterestRetransmitted callbacks. This must be called on the
+     * root node.
+     * @param retransmittedNamespace The node which re-expressed the Interest.
+     */
+    void
+    fireOnInterestRetransmitted(Namespace& retransmittedNamespace);
+
+    /**
+     * FreshnessExpiry is an entry in the root's freshness expiry queue.
+     */
+    class FreshnessExpiry {
+    public:
+      FreshnessExpiry
+        (std::chrono::system_clock::time_point expiryTime,
+         const ndn::ptr_lib::weak_ptr<Namespace::Impl>& impl)
+      : expiryTime_(expiryTime), impl_(impl)
+      {}
+
+      std::chrono::system_clock::time_point
+      getExpiryTime() const { return expiryTime_; }
+
+      const ndn::ptr_lib::weak_ptr<Namespace::Impl>&
+      getImpl() const { return impl_; }
+
+      /**
+       * This is used to make the priority_queue a min-heap by expiry time.
+       */
+      bool
+      operator > (const FreshnessExpiry& other) const
+      {
+        return expiryTime_ > other.expiryTime_;
+      }
+
+    private:
+      std::chrono::system_clock::time_point expiryTime_;
+      ndn::ptr_lib::weak_ptr<Namespace::Impl> impl_;
+    };
+
+    /**
+     * RootState holds the state of the name tree which only the root node
+     * allocates, so that the other nodes don't carry it. Each node reaches it
+     * through getRootState().
+     */
+    class RootState {
+    public:
+      RootState()
+      : oldestPayload_(0), newestPayload_(0), totalPayloadBytes_(0),
+        maxPayloadBytes_(0), removeEmptyNodes_(false), nEvictedPayloadBytes_(0),
+        isEvicting_(false), batchDepth_(0), maxSpeculativeNodes_(10000),
+        freshnessTimerTime_(std::chrono::system_clock::time_point::max()),
+        refetchStaleObjects_(false), maxPendingIncomingInterests_(0),
+        incomingInterestOverloadPolicy_
+          (IncomingInterestOverloadPolicy_DROP_OLDEST),
+        settingsEpoch_(1), listenersEpoch_(1), nNegativeCacheHits_(0)
+      {}
+
+      // The least and most recently used nodes in the payload list.
+      Namespace::Impl* oldestPayload_;
+      Namespace::Impl* newestPayload_;
+      size_t totalPayloadBytes_;
+      size_t maxPayloadBytes_; // 0 for no limit.
+      bool removeEmptyNodes_;
+      size_t nEvictedPayloadBytes_;
+      bool isEvicting_;
+      CallbackRegistry<OnEvicted> onEvictedCallbacks_;
+      CallbackRegistry<OnInterestRetransmitted>
+        onInterestRetransmittedCallbacks_;
+      int batchDepth_;
+      // The nodes whose state changed during the batch, in order of first
+      // change.
+      std::vector<ndn::ptr_lib::shared_ptr<Namespace::Impl>> batchChangedNodes_;
+      // This is shared with the speculativeNodeCount_ of each speculative node.
+      ndn::ptr_lib::shared_ptr<size_t> nSpeculativeNodes_;
+      size_t maxSpeculativeNodes_;
+      std::priority_queue
+        <FreshnessExpiry, std::vector<FreshnessExpiry>,
+         std::greater<FreshnessExpiry>> freshnessExpiryQueue_;
+      // The time of the earliest pending freshness timer, or max() if none.
+      std::chrono::system_clock::time_point freshnessTimerTime_;
+      bool refetchStaleObjects_;
+      // objectNeeded will create this.
+      ndn::ptr_lib::shared_ptr<OutgoingInterestTable> outgoingInterestTable_;
+      // getRttEstimator will create this.
+      ndn::ptr_lib::shared_ptr<RttEstimator> rttEstimator_;
+      // createPendingIncomingInterestTable will create this.
+      ndn::ptr_lib::shared_ptr<PendingIncomingInterestTable>
+        pendingIncomingInterestTable_;
+      // Used to create pendingIncomingInterestTable_.
+      size_t maxPendingIncomingInterests_; // 0 for no limit.
+      IncomingInterestOverloadPolicy incomingInterestOverloadPolicy_;
+      // enableSync will create this.
+      ndn::ptr_lib::shared_ptr<ndn::FullPSync2017> fullPSync_;
+      // createChild will create this.
+      ndn::ptr_lib::shared_ptr<NamespaceNodePool> nodePool_;
+      // Incremented by invalidateInheritedSettings().
+      uint64_t settingsEpoch_;
+      // Incremented by invalidateNearestListeners().
+      uint64_t listenersEpoch_;
+      uint64_t nNegativeCacheHits_;
+    };
+
+    RootState&
+    getRootState() { return *root_->rootState_; }
+
+    /**
+     * Add this node to the root's freshness expiry queue for its
+     * freshnessExpiryTime_. If this is the earliest expiry and a Face is
+     * available, use callLater to call onFreshnessTimer at the expiry time.
+     */
+    void
+    scheduleFreshnessExpiry();
+
+    /**
+     * This is called on the root node to process every entry in the freshness
+     * expiry queue whose expiry time is not later than nowTimePoint. If the
+     * node still has the Data packet with the same expiry time, then set
+     * isStale_ and change the state OBJECT_READY to OBJECT_READY_BUT_STALE.
+     * If refetchStaleObjects_, call objectNeeded(true) on the node. This is
+     * called by the timer, and also at the start of onInterest and objectNeeded
+     * in case there is no Face to schedule the timer.
+     * However, if getIsShutDown() then do nothing.
+     * @param nowTimePoint The current time.
+     */
+    void
+    expireFreshness(std::chrono::system_clock::time_point nowTimePoint);
+
+    /**
+     * This is called on the root node by the timer from scheduleFreshnessExpiry.
+     */
+    void
+    onFreshnessTimer();
+
     /**
      * Get the maximum Interest lifetime that was set on this or a parent node.
      * @return The maximum Interest lifetime, or the default if not set on this
@@ -891,6 +2223,32 @@ public:
     std::chrono::nanoseconds
     getMaxInterestLifetime();
 
+    /**
+     * Get the negative cache time to live that was set on this or a parent
+     * node.
+     * @return The time to live, or a negative value if not set on this or any
+     * parent.
+     */
+    std::chrono::nanoseconds
+    getNegativeCacheTtl();
+
+    /**
+     * Remember the failure of the Interest for this node so that objectNeeded
+     * doesn't express another Interest until the negative cache entry expires.
+     * Do nothing if the negative cache is disabled.
+     * @param networkNack The network Nack, or null for a timeout.
+     */
+    void
+    addNegativeCacheEntry(const ndn::NetworkNack* networkNack);
+
+    /**
+     * This is called by callLater from objectNeeded to set the cached failure
+     * state again, unless a Data packet arrived or this node was deleted in the
+     * meantime.
+     */
+    void
+    replayNegativeCacheEntry();
+
     /**
      * Get the decryptor set by setDecryptor on this or a parent Namespace node.
      * @return The DecryptorV2, or null if not set on this or any parent.
@@ -913,8 +2271,32 @@ public:
     createChild(const ndn::Name::Component& component, bool fireCallbacks);
 
     /**
-     * Set the state of this Namespace object and call the OnStateChanged
-     * callbacks for this and all parents. This does not check if this Namespace
+     * Set the state to NamespaceState_NAME_EXISTS to fire the OnStateChanged
+     * callbacks for this and all parents and, if this node is within the depth
+     * of a node with enableSync, publish the name to sync. This is called for
+     * a new node which should be reported. If a producer already changed the
+     * state of a speculative node, this fires the callbacks for
+     * NamespaceState_NAME_EXISTS without changing the state.
+     */
+    void
+    announceName();
+
+    /**
+     * Find the deepest existing node on the path to the descendant name,
+     * without creating any nodes.
+     * @param descendantName The name of the descendant. The name of this node
+     * must be a prefix.
+     * @return The node whose name equals descendantName if it exists,
+     * otherwise its deepest existing ancestor (which may be this node).
+     */
+    Namespace::Impl*
+    findDeepestImpl(const ndn::Name& descendantName);
+
+    /**
+     * Set the state of this Namespace object and call the OnStateChanged and
+     * OnStateChangedBatch callbacks for this and all parents. If a batch is in
+     * progress, only add this node to the root's batchChangedNodes_ so that
+     * commitBatch calls the callbacks. This does not check if this Namespace
      * object already has the given state.
      * However, if getIsShutDown() then do nothing.
      * @param state The new state.
@@ -922,9 +2304,21 @@ public:
     void
     setState(NamespaceState state);
 
+    /**
+     * Call the OnStateChanged and OnStateChangedBatch callbacks for this and
+     * all parents with the given state, without changing state_. This is
+     * called by setState when a batch is not in progress.
+     * @param state The state to report.
+     */
+    void
+    fireStateChanged(NamespaceState state);
+
     void
     fireOnStateChanged(Namespace& changedNamespace, NamespaceState state);
 
+    void
+    fireOnStateChangedBatch(const std::vector<Namespace*>& changedNamespaces);
+
     /**
      * Set the validate state of this Namespace object and call the
      * OnValidateStateChanged callbacks for this and all parents. This does not
@@ -963,10 +2357,15 @@ public:
 
     /**
      * This is the default OnInterest callback which searches this node and
-     * children nodes for a matching Data packet, longest prefix. This calls
-     * face.putData(). If an existing Data packet is not found, add the
+     * children nodes for a matching Data packet, longest prefix. This sends the
+     * saved wire encoding of the Data packet with face.send(). The search does
+     * not create nodes. If an existing Data packet is not found, add the
      * Interest to the PendingIncomingInterestTable so that a later call to
-     * setData may satisfy it.
+     * setData may satisfy it. Then, if a parent has an OnObjectNeeded
+     * callback, create the node for the Interest name (up to
+     * maxSpeculativeNodes_) and call the callbacks. If a callback claims it,
+     * announce the created nodes. If no callback claims it, remove the created
+     * nodes.
      * However, if getIsShutDown() then do nothing.
      */
     void
@@ -978,29 +2377,79 @@ public:
 
     /**
      * This is a helper for onInterest to find the longest-prefix match under
-     * the given Namespace.
+     * the given Namespace. Among matches of the same length, return the one
+     * with the "less than" name. This skips children whose subtree has no Data
+     * packet or can't have a longer match than one already found. If the
+     * Interest has MustBeFresh, this skips nodes whose isStale_ is set, so the
+     * caller should first call expireFreshness.
      * @param nameSpace This searches this Namespace and its children.
      * @param interest This calls interest.matchesData().
-     * @param nowTimePoint The current time point for checking Data packet
-     * freshness.
      * @return The Namespace object for the matched name or null if not found.
      */
     static Namespace::Impl*
     findBestMatchName
-      (Namespace::Impl& nameSpace, const ndn::Interest& interest,
-       std::chrono::system_clock::time_point nowTimePoint);
+      (Namespace::Impl& nameSpace, const ndn::Interest& interest);
 
     void
     onData(const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest,
            const ndn::ptr_lib::shared_ptr<ndn::Data>& data);
 
+    /**
+     * Get the RttEstimator of the root node, creating it if needed.
+     * @return The RttEstimator.
+     */
+    RttEstimator&
+    getRttEstimator();
+
+    /**
+     * Express the Interest for this node on the Face, calling onData,
+     * onInterestTimeout or onNetworkNack. Save the send time to measure the
+     * round-trip time.
+     * @param face The Face for expressInterest.
+     * @param interest The Interest to express.
+     * @param isRetransmission True if this re-expresses an Interest which
+     * timed out, or if another Interest for this node is still in flight. By
+     * Karn's algorithm, the Data packet for a re-expressed Interest is not used
+     * to measure the round-trip time.
+     * @throws std::exception from Face::expressInterest. If this is not a
+     * retransmission, this first removes the entry which objectNeeded added
+     * to the outgoing Interest table.
+     */
+    void
+    expressInterest
+      (ndn::Face* face, const ndn::Interest& interest, bool isRetransmission);
+
+    /**
+     * Get the lifetime for a new Interest, which is the retransmission timeout
+     * but not more than getMaxInterestLifetime().
+     * @return The Interest lifetime.
+     */
+    std::chrono::nanoseconds
+    getNewInterestLifetime();
+
+    /**
+     * This is called when an Interest from expressInterest times out. Back off
+     * the retransmission timeout and re-express the Interest with double the
+     * lifetime and call the OnInterestRetransmitted callbacks, or call
+     * onTimeout if that would exceed the maximum Interest lifetime.
+     * @param interest The Interest which timed out.
+     * @param interestSerial The value of interestSerial_ when the Interest was
+     * expressed. If this node expressed another Interest since then, ignore
+     * the timeout.
+     */
+    void
+    onInterestTimeout
+      (const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest,
+       uint64_t interestSerial);
+
     void
     onTimeout(const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest);
 
     void
     onNetworkNack
       (const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest,
-       const ndn::ptr_lib::shared_ptr<ndn::NetworkNack>& networkNack);
+       const ndn::ptr_lib::shared_ptr<ndn::NetworkNack>& networkNack,
+       uint64_t interestSerial);
 
     void
     onDecryptionError
@@ -1018,41 +2467,113 @@ public:
     onNamesUpdate(const ndn::ptr_lib::shared_ptr<std::vector<ndn::Name>>& names);
 
     Namespace& outerNamespace_;
+    // Only the root has its full name. Other nodes only store component_ and
+    // leave name_ empty, so that a large tree doesn't keep a Name per node.
     ndn::Name name_;
+    ndn::Name::Component component_;
+    size_t depth_;
     // parent_ and root_ may be updated by createChild.
     Namespace::Impl* parent_;
     Namespace::Impl* root_;
+    // Only the root node allocates this. It is declared before children_ so
+    // that it is destroyed after the child nodes.
+    ndn::ptr_lib::unique_ptr<RootState> rootState_;
     // The key is a Name::Component. The value is the child Namespace.
-    std::map<ndn::Name::Component, ndn::ptr_lib::shared_ptr<Namespace>> children_;
+    ChildMap children_;
+    // The children sorted by name component, rebuilt by getSortedChildren()
+    // when isSortedChildrenValid_ is false.
+    std::vector<Namespace::Impl*> sortedChildren_;
+    bool isSortedChildrenValid_;
     NamespaceState state_;
     ndn::ptr_lib::shared_ptr<ndn::NetworkNack> networkNack_;
     NamespaceValidateState validateState_;
     ndn::ptr_lib::shared_ptr<ndn::ValidationError> validationError_;
     std::chrono::system_clock::time_point freshnessExpiryTime_;
+    // objectNeeded doesn't express an Interest before this time. This is min()
+    // if there is no negative cache entry.
+    std::chrono::system_clock::time_point negativeCacheExpiryTime_;
+    // The number of consecutive failures since the last Data packet, used for
+    // the negative cache backoff.
+    int nNegativeCacheFailures_;
+    // The failure state which replayNegativeCacheEntry sets again.
+    NamespaceState negativeCacheState_;
+    // expressInterest sets these for the Interest in flight for this node.
+    std::chrono::steady_clock::time_point interestSendTime_;
+    // False if the Interest was re-expressed or already measured.
+    bool canMeasureRtt_;
+    // Incremented by expressInterest so that onInterestTimeout can ignore
+    // an Interest which was superseded.
+    uint64_t interestSerial_;
+    // This is set by expireFreshness when freshnessExpiryTime_ has passed.
+    bool isStale_;
     ndn::ptr_lib::shared_ptr<ndn::Data> data_;
+    // The wire encoding of data_, saved by setData so that sending the Data
+    // packet doesn't encode it again.
+    ndn::Blob dataWireEncoding_;
+    // The number of nodes with a data_ packet in the subtree of this node,
+    // including this node.
+    size_t nDataNodes_;
+    // An upper bound of the depth_ of the nodes with a data_ packet in the
+    // subtree of this node, or 0 if nDataNodes_ is 0.
+    size_t maxDataDepth_;
     ndn::ptr_lib::shared_ptr<Object> object_;
     ndn::Face* face_;
     uint64_t registeredPrefixId_;
+    // The Face and registered prefix ID for each call to addFace.
+    std::vector<std::pair<ndn::Face*, uint64_t>> addedFaces_;
     ndn::KeyChain* keyChain_;
     ndn::ptr_lib::shared_ptr<ndn::MetaInfo> newDataMetaInfo_;
     ndn::DecryptorV2* decryptor_;
     std::string decryptionError_;
     std::string signingError_;
-    // The key is the callback ID. The value is the OnStateChanged function.
-    std::map<uint64_t, OnStateChanged> onStateChangedCallbacks_;
-    // The key is the callback ID. The value is the OnValidateStateChanged function.
-    std::map<uint64_t, OnValidateStateChanged> onValidateStateChangedCallbacks_;
-    // The key is the callback ID. The value is the OnObjectNeeded function.
-    std::map<uint64_t, OnObjectNeeded> onObjectNeededCallbacks_;
-    // The key is the callback ID. The value is the OnDeserializeNeeded function.
-    std::map<uint64_t, Handler::OnDeserializeNeeded> onDeserializeNeededCallbacks_;
-    // setFace will create this in the root Namespace node.
-    ndn::ptr_lib::shared_ptr<PendingIncomingInterestTable>
-      pendingIncomingInterestTable_;
-    // This will be created in the root Namespace node.
-    ndn::ptr_lib::shared_ptr<ndn::FullPSync2017> fullPSync_;
+    CallbackRegistry<FilteredCallback<OnStateChanged>> onStateChangedCallbacks_;
+    CallbackRegistry<FilteredCallback<OnValidateStateChanged>>
+      onValidateStateChangedCallbacks_;
+    // The bitwise OR of the state masks of onStateChangedCallbacks_, so that
+    // fireOnStateChanged can quickly skip this node.
+    uint32_t onStateChangedStateMask_;
+    // The bitwise OR of the state masks of onValidateStateChangedCallbacks_.
+    uint32_t onValidateStateChangedStateMask_;
+    // For each ListenerKind, this or the nearest parent node which has
+    // callbacks of that kind, as resolved by resolveNearestListeners(). These
+    // are only valid if nearestListenersEpoch_ equals the root's
+    // listenersEpoch_.
+    uint64_t nearestListenersEpoch_;
+    Namespace::Impl* nearestListener_[N_LISTENER_KINDS];
+    CallbackRegistry<OnObjectNeeded> onObjectNeededCallbacks_;
+    CallbackRegistry<Handler::OnDeserializeNeeded> onDeserializeNeededCallbacks_;
+    // The number of bytes of data_ and object_ as counted by updatePayload().
+    size_t payloadBytes_;
+    // The links in the root's payload list, from the least to the most recently
+    // used node. isInPayloadList_ is true if this node is in the list.
+    Namespace::Impl* olderPayload_;
+    Namespace::Impl* newerPayload_;
+    bool isInPayloadList_;
+    CallbackRegistry<OnStateChangedBatch> onStateChangedBatchCallbacks_;
+    CallbackRegistry<OnIncomingInterestTimeout>
+      onIncomingInterestTimeoutCallbacks_;
+    // True if this node is in the root's batchChangedNodes_.
+    bool isInBatch_;
+    // True if the outer Namespace was deleted.
+    bool isDeleted_;
+    // If this node is speculative, this is the root's nSpeculativeNodes_.
+    // This is shared so that the count can be decremented after the root is
+    // deleted.
+    ndn::ptr_lib::shared_ptr<size_t> speculativeNodeCount_;
     std::chrono::nanoseconds maxInterestLifetime_; // -1 if not specified.
+    std::chrono::nanoseconds negativeCacheTtl_; // -1 if not specified.
     int syncDepth_; // -1 if not specified.
+    // The settings of this or the nearest parent node which has them, as
+    // resolved by resolveInheritedSettings(). These are only valid if
+    // inheritedSettingsEpoch_ equals the root's settingsEpoch_.
+    uint64_t inheritedSettingsEpoch_;
+    ndn::Face* inheritedFace_;
+    ndn::KeyChain* inheritedKeyChain_;
+    ndn::DecryptorV2* inheritedDecryptor_;
+    const ndn::MetaInfo* inheritedNewDataMetaInfo_;
+    std::chrono::nanoseconds inheritedMaxInterestLifetime_;
+    std::chrono::nanoseconds inheritedNegativeCacheTtl_;
+    Namespace::Impl* inheritedSyncNode_;
     ndn::ptr_lib::shared_ptr<bool> isShutDown_;
   };
 
@@ -1064,13 +2585,12 @@ private:
   Namespace& operator=(const Namespace& other);
 
   /**
-   * This private constructor is used by Impl::createChild for passing isShutDown.
+   * This private constructor is used by Impl::createChild for passing the
+   * root's node pool (which also allocates the Impl) and isShutDown. The
+   * caller sets the name component and depth of the Impl.
    */
-  Namespace(const ndn::Name& name, ndn::KeyChain* keyChain,
-            const ndn::ptr_lib::shared_ptr<bool>& isShutDown)
-  : impl_(ndn::ptr_lib::make_shared<Impl>(*this, name, keyChain, isShutDown))
-  {
-  }
+  Namespace(const ndn::ptr_lib::shared_ptr<NamespaceNodePool>& nodePool,
+            const ndn::ptr_lib::shared_ptr<bool>& isShutDown);
 
   ndn::ptr_lib::shared_ptr<Impl> impl_;
 #ifdef NDN_CPP_HAVE_BOOST_ASIO
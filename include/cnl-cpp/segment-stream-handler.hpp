@@ -23,6 +23,7 @@
 #define CNL_CPP_SEGMENT_STREAM_HANDLER_HPP
 
 #include "namespace.hpp"
+#include "interest-window-controller.hpp"
 
 extern "C" {
 
@@ -44,6 +45,8 @@ namespace cnl_cpp {
 class cnl_cpp_dll SegmentStreamHandler : public Namespace::Handler {
 public:
   typedef ndn::func_lib::function<void(Namespace* segmentNamespace)> OnSegment;
+  typedef ndn::func_lib::function<void(Namespace* segmentNamespace)>
+    OnSegmentFailed;
 
   /**
    * Create a SegmentStreamHandler with the optional onSegment callback.
@@ -93,11 +96,31 @@ public:
     return impl_->addOnSegment(onSegment);
   }
 
+  /**
+   * Add an onSegmentFailed callback. When the Interest for a segment times out
+   * or gets a network Nack, this re-expresses it up to getMaxSegmentRetries()
+   * times. If it still fails, this calls onSegmentFailed as described below.
+   * Since segments are supplied in order, no later segments are supplied.
+   * @param onSegmentFailed This calls onSegmentFailed(segmentNamespace) where
+   * segmentNamespace is the Namespace of the segment, where you can use
+   * segmentNamespace.getState() to check for NamespaceState_INTEREST_TIMEOUT
+   * or NamespaceState_INTEREST_NETWORK_NACK.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   * @return The callback ID which you can use in removeCallback().
+   */
+  uint64_t
+  addOnSegmentFailed(const OnSegmentFailed& onSegmentFailed)
+  {
+    return impl_->addOnSegmentFailed(onSegmentFailed);
+  }
+
   /**
    * Remove the callback with the given callbackId. This does not search for the
    * callbackId in child nodes. If the callbackId isn't found, do nothing.
    * @param callbackId The callback ID returned, for example, from
-   * addOnSegment.
+   * addOnSegment or addOnSegmentFailed.
    */
   void
   removeCallback(uint64_t callbackId) { impl_->removeCallback(callbackId); }
@@ -122,6 +145,110 @@ public:
     impl_->setInterestPipelineSize(interestPipelineSize);
   }
 
+  /**
+   * Get the InterestWindowController set by setInterestWindowController.
+   * @return The InterestWindowController, or null if not set.
+   */
+  const ndn::ptr_lib::shared_ptr<InterestWindowController>&
+  getInterestWindowController() { return impl_->getInterestWindowController(); }
+
+  /**
+   * Set the InterestWindowController which decides the number of outstanding
+   * interests while fetching segments, instead of the fixed Interest pipeline
+   * size. This reports each received segment, congestion mark, congestion
+   * Nack and timeout to the controller, including each timeout where Namespace
+   * re-expresses the Interest, along with the current retransmission timeout.
+   * For example, use an AimdInterestWindowController or
+   * CubicInterestWindowController to adapt to the capacity of the path.
+   * @param interestWindowController The InterestWindowController, or null to
+   * use the Interest pipeline size.
+   */
+  void
+  setInterestWindowController
+    (const ndn::ptr_lib::shared_ptr<InterestWindowController>&
+       interestWindowController)
+  {
+    impl_->setInterestWindowController(interestWindowController);
+  }
+
+  /**
+   * Get the number of outstanding interests which this currently maintains
+   * while fetching segments. This is the window size of the
+   * InterestWindowController if set, otherwise the Interest pipeline size.
+   * @return The current Interest window size.
+   */
+  int
+  getInterestWindowSize() { return impl_->getInterestWindowSize(); }
+
+  /**
+   * Get the maximum number of bytes buffered ahead of the in-order point, as
+   * described in setMaxBufferedBytes.
+   * @return The maximum buffered bytes, or 0 for no limit.
+   */
+  size_t
+  getMaxBufferedBytes() { return impl_->getMaxBufferedBytes(); }
+
+  /**
+   * Set the maximum number of bytes buffered ahead of the in-order point, which
+   * is the total payload bytes (see Namespace.getNodePayloadBytes) of received
+   * segments which can't be supplied to onSegment until a missing earlier
+   * segment arrives. While the buffered bytes plus the expected size of the
+   * outstanding segments would exceed this, this doesn't express new
+   * Interests, except for the next segment in order. This limits memory use on
+   * a lossy link regardless of the Interest window.
+   * @param maxBufferedBytes The maximum buffered bytes, or 0 for no limit. If
+   * you don't set this, the default is 0.
+   */
+  void
+  setMaxBufferedBytes(size_t maxBufferedBytes)
+  {
+    impl_->setMaxBufferedBytes(maxBufferedBytes);
+  }
+
+  /**
+   * Get the number of bytes buffered ahead of the in-order point, as described
+   * in setMaxBufferedBytes.
+   * @return The buffered bytes.
+   */
+  size_t
+  getBufferedBytes() { return impl_->getBufferedBytes(); }
+
+  /**
+   * Get the number of segment Interests which this re-expressed because
+   * segments with higher numbers arrived while the segment was missing. When
+   * three later segments arrive, this calls reExpressInterest() on the missing
+   * segment without waiting for the Interest to time out. To avoid repeating
+   * for segments which were requested before the retransmission, this waits
+   * for another window of later segments before re-expressing again.
+   * @return The number of re-expressed Interests.
+   */
+  uint64_t
+  getNRetransmissions() { return impl_->getNRetransmissions(); }
+
+  /**
+   * Get the maximum number of times to re-express the Interest for a segment
+   * which times out or gets a network Nack, as described in
+   * setMaxSegmentRetries.
+   * @return The maximum number of retries.
+   */
+  int
+  getMaxSegmentRetries() { return impl_->getMaxSegmentRetries(); }
+
+  /**
+   * Set the maximum number of times to re-express the Interest for a segment
+   * which times out or gets a network Nack. Before each retry, this clears
+   * the segment's negative cache entry (see Namespace.setNegativeCacheTtl).
+   * After the last retry fails, this calls the onSegmentFailed callbacks.
+   * @param maxSegmentRetries The maximum number of retries. If you don't set
+   * this, the default is 3.
+   * @throws runtime_error if maxSegmentRetries is less than 0.
+   */
+  void
+  setMaxSegmentRetries(int maxSegmentRetries)
+  {
+    impl_->setMaxSegmentRetries(maxSegmentRetries);
+  }
+
   /**
    * Get the initial Interest count (as described in setInitialInterestCount).
    * @return The initial Interest count.
@@ -217,6 +344,9 @@ private:
     uint64_t
     addOnSegment(const OnSegment& onSegment);
 
+    uint64_t
+    addOnSegmentFailed(const OnSegmentFailed& onSegmentFailed);
+
     void
     removeCallback(uint64_t callbackId);
 
@@ -226,6 +356,45 @@ private:
     void
     setInterestPipelineSize(int interestPipelineSize);
 
+    const ndn::ptr_lib::shared_ptr<InterestWindowController>&
+    getInterestWindowController() { return interestWindowController_; }
+
+    void
+    setInterestWindowController
+      (const ndn::ptr_lib::shared_ptr<InterestWindowController>&
+         interestWindowController)
+    {
+      interestWindowController_ = interestWindowController;
+    }
+
+    int
+    getInterestWindowSize()
+    {
+      return interestWindowController_ ?
+        interestWindowController_->getWindowSize() : interestPipelineSize_;
+    }
+
+    uint64_t
+    getNRetransmissions() { return nRetransmissions_; }
+
+    size_t
+    getMaxBufferedBytes() { return maxBufferedBytes_; }
+
+    void
+    setMaxBufferedBytes(size_t maxBufferedBytes)
+    {
+      maxBufferedBytes_ = maxBufferedBytes;
+    }
+
+    size_t
+    getBufferedBytes() { return bufferedBytes_; }
+
+    int
+    getMaxSegmentRetries() { return maxSegmentRetries_; }
+
+    void
+    setMaxSegmentRetries(int maxSegmentRetries);
+
     int
     getInitialInterestCount() { return initialInterestCount_; }
 
@@ -249,6 +418,16 @@ private:
     onNamespaceSet(Namespace* nameSpace);
 
   private:
+    /**
+     * This is called by setObject inside a batch of state changes to make the
+     * segment Data packets, the optional _manifest and the object.
+     * @param finalSegment The segment number of the final segment.
+     */
+    void
+    setSegments
+      (Namespace& nameSpace, const ndn::Blob& object, bool useSignatureManifest,
+       ndn::KeyChain* keyChain, uint64_t finalSegment);
+
     /**
      * Start fetching segment Data packets and adding them as children of
      * getNamespace(), calling any onSegment callbacks in order as the
@@ -265,21 +444,75 @@ private:
       (Namespace& nameSpace, Namespace& changedNamespace, NamespaceState state,
        uint64_t callbackId);
 
+    /**
+     * This is called when a node in the tree re-expresses its Interest after
+     * a timeout. If it is a segment, report the timeout to the
+     * InterestWindowController.
+     */
+    void
+    onInterestRetransmitted
+      (Namespace& nameSpace, Namespace& retransmittedNamespace,
+       uint64_t callbackId);
+
     void
     requestNewSegments(int maxRequestedSegments);
 
+    /**
+     * This is called when the Interest for the segment times out or gets a
+     * network Nack. Re-express it up to maxSegmentRetries_ times, then call
+     * the onSegmentFailed callbacks.
+     * @param segment The segment Namespace.
+     */
+    void
+    onSegmentFailure(Namespace& segment);
+
+    /**
+     * Count the received segment for each missing segment before it and
+     * re-express the Interest for a missing segment when enough later segments
+     * have arrived, as described in getNRetransmissions.
+     * @param receivedSegmentNumber The number of the received segment.
+     */
+    void
+    retransmitMissingSegments(int receivedSegmentNumber);
+
     void
     fireOnSegment(Namespace* segmentNamespace);
 
+    void
+    fireOnSegmentFailed(Namespace* segmentNamespace);
+
     int maxReportedSegmentNumber_;
     bool didRequestFinalSegment_;
     int finalSegmentNumber_;
     int interestPipelineSize_;
+    ndn::ptr_lib::shared_ptr<InterestWindowController> interestWindowController_;
     int initialInterestCount_;
-    // The key is the callback ID. The value is the OnSegment function.
-    std::map<uint64_t, OnSegment> onSegmentCallbacks_;
+    // The key is the number of a missing segment, which is after the in-order
+    // point and before maxReceivedSegmentNumber_ but not received yet. The
+    // value is the number of later segments received since it was last
+    // requested.
+    std::map<int, int> nLaterSegments_;
+    uint64_t nRetransmissions_;
+    // The key is the number of a segment which failed. The value is the number
+    // of times it was requested again.
+    std::map<int, int> nSegmentRetries_;
+    int maxSegmentRetries_;
+    // The key is the number of a received segment after the in-order point.
+    // The value is its payload bytes, which are included in bufferedBytes_.
+    std::map<int, size_t> bufferedSegments_;
+    size_t bufferedBytes_;
+    size_t maxBufferedBytes_;
+    // The largest payload bytes of a received segment, used to estimate the
+    // size of outstanding segments.
+    size_t maxReceivedSegmentSize_;
+    int maxReceivedSegmentNumber_;
+    // The largest segment number which requestNewSegments requested.
+    int maxRequestedSegmentNumber_;
+    CallbackRegistry<OnSegment> onSegmentCallbacks_;
+    CallbackRegistry<OnSegmentFailed> onSegmentFailedCallbacks_;
     uint64_t onObjectNeededId_;
     uint64_t onStateChangedId_;
+    uint64_t onInterestRetransmittedId_;
     Namespace* namespace_;
     size_t maxSegmentPayloadLength_;
   };
@@ -22,17 +22,20 @@
 #ifndef CNL_CPP_SEGMENTED_OBJECT_HANDLER_HPP
 #define CNL_CPP_SEGMENTED_OBJECT_HANDLER_HPP
 
+#include <iosfwd>
 #include "segment-stream-handler.hpp"
 
 namespace cnl_cpp {
 
 /**
  * SegmentedObjectHandler extends SegmentStreamHandler and assembles the
- * contents of child segments into a single block of memory.
+ * contents of child segments into a single block of memory, or supplies them in
+ * order to a payload sink (see setPayloadSink).
  */
 class cnl_cpp_dll SegmentedObjectHandler : public SegmentStreamHandler {
 public:
   typedef ndn::func_lib::function<void(Namespace& objectNamespace)> OnSegmentedObject;
+  typedef ndn::func_lib::function<void(const ndn::Blob& payload)> OnPayload;
 
   /**
    * Create a SegmentedObjectHandler with the optional onSegmentedObject callback.
@@ -68,13 +71,55 @@ public:
       (SegmentStreamHandler::setNamespace(nameSpace));
   }
 
+  /**
+   * Set the payload sink which receives the content of each segment in order
+   * as it arrives, instead of assembling the object in memory. When a segment
+   * is supplied, this calls releasePayloadLater() on the segment node, which
+   * releases and removes it after the current callbacks, so that fetching a
+   * large object uses bounded memory. (Therefore, you can't use
+   * verifyWithManifest or the segment nodes after they are supplied.) When
+   * all segments are supplied, this calls the OnSegmentedObject callbacks, but
+   * the object is not set. Call this before fetching the segments.
+   * @param onPayload This calls onPayload(payload) for each segment, where
+   * payload is the segment content.
+   * NOTE: The library will log any exceptions thrown by this callback, but for
+   * better error handling the callback should catch and properly handle any
+   * exceptions.
+   */
+  void
+  setPayloadSink(const OnPayload& onPayload)
+  {
+    impl_->setPayloadSink(onPayload);
+  }
+
+  /**
+   * Set the payload sink as described in setPayloadSink(onPayload), where each
+   * segment's content is written to the stream.
+   * @param stream The output stream. The stream must remain valid until the
+   * OnSegmentedObject callbacks are called.
+   */
+  void
+  setPayloadSink(std::ostream& stream) { impl_->setPayloadSink(stream); }
+
+  /**
+   * Set the payload sink as described in setPayloadSink(onPayload), where each
+   * segment's content is written to the file descriptor. A write error is
+   * logged.
+   * @param fileDescriptor The open file descriptor, for example of a file or
+   * pipe. This does not close it.
+   */
+  void
+  setPayloadSink(int fileDescriptor) { impl_->setPayloadSink(fileDescriptor); }
+
   /**
    * Add an OnSegmentedObject callback. When the child segments are assembled
    * into a single block of memory, this calls onSegmentedObject as described
    * below.
    * @param onSegmentedObject This calls onSegmentedObject(objectNamespace) 
    * where objectNamespace.getObject() is the object that was assembled from the
-   * segment contents and deserialized.
+   * segment contents and deserialized. (If you called setPayloadSink, then
+   * this is called after supplying all segments to the sink, and the object
+   * is not set.)
    * NOTE: The library will log any exceptions thrown by this callback, but for
    * better error handling the callback should catch and properly handle any
    * exceptions.
@@ -135,6 +180,15 @@ private:
     void
     removeCallback(uint64_t callbackId);
 
+    void
+    setPayloadSink(const OnPayload& onPayload) { onPayload_ = onPayload; }
+
+    void
+    setPayloadSink(std::ostream& stream);
+
+    void
+    setPayloadSink(int fileDescriptor);
+
     void
     onNamespaceSet(Namespace* nameSpace)
     {
@@ -152,8 +206,9 @@ private:
 
     std::vector<ndn::Blob> segments_;
     size_t totalSize_;
-    // The key is the callback ID. The value is the OnSegmentedObject function.
-    std::map<uint64_t, OnSegmentedObject> onSegmentedObjectCallbacks_;
+    // If set, supply each segment to this instead of saving it in segments_.
+    OnPayload onPayload_;
+    CallbackRegistry<OnSegmentedObject> onSegmentedObjectCallbacks_;
     Namespace* namespace_;
   };
 
@@ -125,15 +125,20 @@ GeneralizedObjectHandler::Impl::onDeserializeNeeded
    const Namespace::Handler::OnDeserialized& onDeserialized,
    uint64_t callbackId)
 {
-  if (blobNamespace.getName().size() !=
-      namespace_->getName().size() + nComponentsAfterObjectNamespace_ + 1)
+  // Go up by parent nodes instead of comparing the length of the full names.
+  Namespace* objectNamespaceAncestor = &blobNamespace;
+  for (int i = 0; i < nComponentsAfterObjectNamespace_ + 1 && objectNamespaceAncestor;
+       ++i)
+    objectNamespaceAncestor = objectNamespaceAncestor->getParent();
+  if (objectNamespaceAncestor != namespace_)
     // This is not a generalized object packet at the correct level under the Namespace.
     return false;
-  if (blobNamespace.getName()[-1] != getNAME_COMPONENT_META()) {
+  const Name::Component& blobComponent = blobNamespace.getNameComponent();
+  if (blobComponent != getNAME_COMPONENT_META()) {
     // Not the _meta packet.
     if (nComponentsAfterObjectNamespace_ > 0 &&
-        (blobNamespace.getName()[-1].isSegment() ||
-         blobNamespace.getName()[-1] == SegmentedObjectHandler::getNAME_COMPONENT_MANIFEST())) {
+        (blobComponent.isSegment() ||
+         blobComponent == SegmentedObjectHandler::getNAME_COMPONENT_MANIFEST())) {
       // This is another packet type for a generalized object and we did not try
       // to fetch the _meta packet in onObjectNeeded. Try fetching it if we
       // haven't already.
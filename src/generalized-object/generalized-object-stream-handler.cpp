@@ -89,9 +89,13 @@ GeneralizedObjectStreamHandler::Impl::onNamespaceSet(Namespace* nameSpace)
   namespace_->addOnObjectNeeded
     (bind(&GeneralizedObjectStreamHandler::Impl::onObjectNeeded,
           shared_from_this(), _1, _2, _3));
+  // onStateChanged only handles these states.
   namespace_->addOnStateChanged
     (bind(&GeneralizedObjectStreamHandler::Impl::onStateChanged,
-          shared_from_this(), _1, _2, _3, _4));
+          shared_from_this(), _1, _2, _3, _4),
+     Namespace::getStateMask(NamespaceState_INTEREST_TIMEOUT) |
+     Namespace::getStateMask(NamespaceState_INTEREST_NETWORK_NACK) |
+     Namespace::getStateMask(NamespaceState_OBJECT_READY));
 }
 
 bool
@@ -133,8 +137,10 @@ GeneralizedObjectStreamHandler::Impl::onStateChanged
 {
   if (state == NamespaceState_INTEREST_TIMEOUT ||
       state == NamespaceState_INTEREST_NETWORK_NACK) {
+    // Build the name once for the checks below.
+    Name changedName = changedNamespace.getName();
     _LOG_INFO("GeneralizedObjectStreamHandler: Got timeout or nack for " <<
-               changedNamespace.getName());
+               changedName);
     if (&changedNamespace == latestNamespace_) {
       // Timeout or network NACK, so try to fetch again.
       latestNamespace_->getFace_()->callLater
@@ -142,26 +148,23 @@ GeneralizedObjectStreamHandler::Impl::onStateChanged
       return;
     }
     else if (pipelineSize_ > 0 &&
-        changedNamespace.getName().size() == namespace_->getName().size() + 2 &&
-        changedNamespace.getName()[-1].equals
+        changedName.size() == namespace_->getName().size() + 2 &&
+        changedName[-1].equals
           (GeneralizedObjectHandler::getNAME_COMPONENT_META()) &&
-        changedNamespace.getName()[-2].isSequenceNumber() &&
-        changedNamespace.getName()[-2].toSequenceNumber() ==
-          maxRequestedSequenceNumber_) {
+        changedName[-2].isSequenceNumber() &&
+        changedName[-2].toSequenceNumber() == maxRequestedSequenceNumber_) {
       // The highest pipelined request timed out, so request the _latest.
       // TODO: Should we do this for the lowest requested?
       _LOG_INFO("GeneralizedObjectStreamHandler: Requesting _latest because the highest pipelined request timed out: " <<
-                 changedNamespace.getName());
+                 changedName);
       latestNamespace_->objectNeeded(true);
       return;
     }
   }
 
   if (!(state == NamespaceState_OBJECT_READY &&
-        changedNamespace.getName().size() ==
-          latestNamespace_->getName().size() + 1 &&
-        latestNamespace_->getName().isPrefixOf(changedNamespace.getName()) &&
-        changedNamespace.getName()[-1].isVersion()))
+        changedNamespace.getParent() == latestNamespace_ &&
+        changedNamespace.getNameComponent().isVersion()))
     // Not a versioned _latest, so ignore.
     return;
 
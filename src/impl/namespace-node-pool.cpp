@@ -0,0 +1,93 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#include <new>
+#include "namespace-node-pool.hpp"
+
+using namespace std;
+
+namespace cnl_cpp {
+
+NamespaceNodePool::NamespaceNodePool(size_t slabSize)
+: slabSize_(slabSize), slabPosition_(0), slabEnd_(0),
+  freeLists_(getSizeClass(MAX_POOLED_SIZE) + 1, (void*)0), nNodes_(0),
+  nBytesInUse_(0), nBlocksInUse_(0), nSystemAllocations_(0)
+{
+}
+
+NamespaceNodePool::~NamespaceNodePool()
+{
+  for (size_t i = 0; i < slabs_.size(); ++i)
+    ::operator delete(slabs_[i]);
+}
+
+void*
+NamespaceNodePool::allocate(size_t size)
+{
+  size_t sizeClass = getSizeClass(size);
+  size_t blockSize = sizeClass * ALIGNMENT;
+  nBytesInUse_ += blockSize;
+  ++nBlocksInUse_;
+
+  if (blockSize > MAX_POOLED_SIZE) {
+    ++nSystemAllocations_;
+    return ::operator new(blockSize);
+  }
+
+  void* block = freeLists_[sizeClass];
+  if (block) {
+    // Pop the block from the free list.
+    freeLists_[sizeClass] = *(void**)block;
+    return block;
+  }
+
+  if ((size_t)(slabEnd_ - slabPosition_) < blockSize) {
+    // Start a new slab. Any remainder of the previous slab is unused.
+    slabPosition_ = (uint8_t*)::operator new(slabSize_);
+    slabEnd_ = slabPosition_ + slabSize_;
+    slabs_.push_back(slabPosition_);
+    ++nSystemAllocations_;
+  }
+
+  block = slabPosition_;
+  slabPosition_ += blockSize;
+  return block;
+}
+
+void
+NamespaceNodePool::deallocate(void* block, size_t size)
+{
+  size_t sizeClass = getSizeClass(size);
+  size_t blockSize = sizeClass * ALIGNMENT;
+  nBytesInUse_ -= blockSize;
+  --nBlocksInUse_;
+
+  if (blockSize > MAX_POOLED_SIZE) {
+    ::operator delete(block);
+    return;
+  }
+
+  // Push the block on the free list.
+  *(void**)block = freeLists_[sizeClass];
+  freeLists_[sizeClass] = block;
+}
+
+}
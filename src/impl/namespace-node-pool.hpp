@@ -0,0 +1,176 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#ifndef CNL_CPP_NAMESPACE_NODE_POOL_HPP
+#define CNL_CPP_NAMESPACE_NODE_POOL_HPP
+
+#include <vector>
+#include <ndn-ind/common.hpp>
+
+namespace cnl_cpp {
+
+/**
+ * NamespaceNodePool is an internal class for the root Namespace node to hand
+ * out the storage of child nodes (the Namespace, its Impl and the shared_ptr
+ * control blocks) in bulk. Blocks are carved from large slabs and kept on a
+ * free list per size class, so creating a node does not call the system
+ * allocator and freeing a subtree just returns its blocks to the free lists for
+ * reuse. The slabs are freed when the pool is destroyed, which happens after
+ * the root and every node allocated from the pool are destroyed.
+ * This is not thread-safe, the same as the Namespace tree.
+ */
+class NamespaceNodePool {
+public:
+  /**
+   * Create a NamespaceNodePool.
+   * @param slabSize (optional) The number of bytes to request from the system
+   * allocator for each slab. If omitted, use 64 KiB.
+   */
+  NamespaceNodePool(size_t slabSize = 64 * 1024);
+
+  ~NamespaceNodePool();
+
+  /**
+   * Get a block of storage from the pool.
+   * @param size The number of bytes needed.
+   * @return A pointer to the block, aligned for any type.
+   */
+  void*
+  allocate(size_t size);
+
+  /**
+   * Return the block to the pool.
+   * @param block The block from allocate().
+   * @param size The same size given to allocate().
+   */
+  void
+  deallocate(void* block, size_t size);
+
+  /**
+   * Update the count of nodes using the pool. This is only used for
+   * statistics.
+   * @param nNodesDelta The number of nodes added (positive) or removed
+   * (negative).
+   */
+  void
+  updateNNodes(int nNodesDelta) { nNodes_ += nNodesDelta; }
+
+  /**
+   * Get the number of nodes using the pool, as updated by updateNNodes.
+   * @return The number of nodes.
+   */
+  size_t
+  getNNodes() const { return nNodes_; }
+
+  /**
+   * Get the number of bytes in blocks which are currently allocated.
+   * @return The number of bytes.
+   */
+  size_t
+  getNBytesInUse() const { return nBytesInUse_; }
+
+  /**
+   * Get the number of blocks which are currently allocated.
+   * @return The number of blocks.
+   */
+  size_t
+  getNBlocksInUse() const { return nBlocksInUse_; }
+
+  /**
+   * Get the number of calls to the system allocator made by the pool (for
+   * slabs and for blocks too large to pool).
+   * @return The number of system allocations.
+   */
+  size_t
+  getNSystemAllocations() const { return nSystemAllocations_; }
+
+private:
+  // Disable the copy constructor and assignment operator.
+  NamespaceNodePool(const NamespaceNodePool& other);
+  NamespaceNodePool& operator=(const NamespaceNodePool& other);
+
+  static size_t
+  getSizeClass(size_t size) { return (size + ALIGNMENT - 1) / ALIGNMENT; }
+
+  static const size_t ALIGNMENT = 16;
+  // Blocks larger than this are allocated from the system allocator.
+  static const size_t MAX_POOLED_SIZE = 4096;
+
+  size_t slabSize_;
+  std::vector<void*> slabs_;
+  uint8_t* slabPosition_;
+  uint8_t* slabEnd_;
+  // The index is the size class. The value is the head of a singly linked
+  // list where the first bytes of each free block point to the next.
+  std::vector<void*> freeLists_;
+  size_t nNodes_;
+  size_t nBytesInUse_;
+  size_t nBlocksInUse_;
+  size_t nSystemAllocations_;
+};
+
+/**
+ * NamespaceNodeAllocator is a standard allocator which gets its storage from a
+ * NamespaceNodePool. It holds a shared_ptr to the pool so that the pool stays
+ * allocated while any block, including a shared_ptr control block, is alive.
+ */
+template<class T> class NamespaceNodeAllocator {
+public:
+  typedef T value_type;
+
+  NamespaceNodeAllocator
+    (const ndn::ptr_lib::shared_ptr<NamespaceNodePool>& pool)
+  : pool_(pool)
+  {}
+
+  template<class U>
+  NamespaceNodeAllocator(const NamespaceNodeAllocator<U>& other)
+  : pool_(other.getPool())
+  {}
+
+  T*
+  allocate(size_t n) { return (T*)pool_->allocate(n * sizeof(T)); }
+
+  void
+  deallocate(T* p, size_t n) { pool_->deallocate(p, n * sizeof(T)); }
+
+  const ndn::ptr_lib::shared_ptr<NamespaceNodePool>&
+  getPool() const { return pool_; }
+
+  template<class U> bool
+  operator == (const NamespaceNodeAllocator<U>& other) const
+  {
+    return pool_ == other.getPool();
+  }
+
+  template<class U> bool
+  operator != (const NamespaceNodeAllocator<U>& other) const
+  {
+    return pool_ != other.getPool();
+  }
+
+private:
+  ndn::ptr_lib::shared_ptr<NamespaceNodePool> pool_;
+};
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#include "outgoing-interest-table.hpp"
+
+using namespace std;
+
+namespace cnl_cpp {
+
+bool
+OutgoingInterestTable::add(const Namespace::Impl* nameSpace, bool mustBeFresh)
+{
+  unordered_map<const Namespace::Impl*, bool>::iterator entry =
+    table_.find(nameSpace);
+  if (entry == table_.end()) {
+    table_[nameSpace] = mustBeFresh;
+    return true;
+  }
+
+  if (entry->second || !mustBeFresh) {
+    // The Interest in flight can answer this request.
+    ++nCoalescedInterests_;
+    return false;
+  }
+
+  // The Interest in flight may return stale Data, so express a new one.
+  entry->second = true;
+  return true;
+}
+
+bool
+OutgoingInterestTable::find
+  (const Namespace::Impl* nameSpace, bool& mustBeFresh) const
+{
+  unordered_map<const Namespace::Impl*, bool>::const_iterator entry =
+    table_.find(nameSpace);
+  if (entry == table_.end())
+    return false;
+
+  mustBeFresh = entry->second;
+  return true;
+}
+
+}
@@ -0,0 +1,98 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#ifndef CNL_CPP_OUTGOING_INTEREST_TABLE_HPP
+#define CNL_CPP_OUTGOING_INTEREST_TABLE_HPP
+
+#include <unordered_map>
+#include <cnl-cpp/namespace.hpp>
+
+namespace cnl_cpp {
+
+/**
+ * OutgoingInterestTable is an internal class to hold the Interests which
+ * Namespace::objectNeeded expressed and which have not received a Data packet,
+ * timeout or network Nack. A later request for the same node while the
+ * Interest is in flight is coalesced with it instead of expressing another
+ * Interest. The response updates the node's state, which all requesters
+ * observe.
+ */
+class OutgoingInterestTable {
+public:
+  OutgoingInterestTable()
+  : nCoalescedInterests_(0)
+  {}
+
+  /**
+   * Add a request to express an Interest for the node.
+   * @param nameSpace The Namespace node whose name is the Interest name.
+   * @param mustBeFresh The MustBeFresh flag of the Interest.
+   * @return True if the caller should express the Interest, or false if an
+   * Interest for the node is already in flight which can answer the request.
+   * (An Interest with MustBeFresh can answer a request without it, but not the
+   * opposite.)
+   */
+  bool
+  add(const Namespace::Impl* nameSpace, bool mustBeFresh);
+
+  /**
+   * Remove the node because its Interest got a response. If the node is not
+   * in the table, do nothing.
+   * @param nameSpace The Namespace node given to add.
+   */
+  void
+  remove(const Namespace::Impl* nameSpace) { table_.erase(nameSpace); }
+
+  /**
+   * Check if the node has an Interest in flight.
+   * @param nameSpace The Namespace node given to add.
+   * @param mustBeFresh If found, set this to the MustBeFresh flag of the
+   * Interest in flight.
+   * @return True if found, otherwise false.
+   */
+  bool
+  find(const Namespace::Impl* nameSpace, bool& mustBeFresh) const;
+
+  /**
+   * Get the number of Interests in flight.
+   * @return The number of Interests.
+   */
+  size_t
+  size() const { return table_.size(); }
+
+  /**
+   * Get the total number of requests which were coalesced with an Interest
+   * in flight instead of expressing another Interest.
+   * @return The number of coalesced requests.
+   */
+  uint64_t
+  getNCoalescedInterests() const { return nCoalescedInterests_; }
+
+private:
+  // The key is the Namespace node. The value is the MustBeFresh flag of the
+  // Interest in flight.
+  std::unordered_map<const Namespace::Impl*, bool> table_;
+  uint64_t nCoalescedInterests_;
+};
+
+}
+
+#endif
@@ -33,7 +33,8 @@ namespace cnl_cpp {
 PendingIncomingInterestTable::Entry::Entry
   (const ptr_lib::shared_ptr<const Interest>& interest, Face& face)
 : interest_(interest), face_(face)
-, timeoutTime_(std::chrono::system_clock::time_point::min())
+, timeoutTime_(std::chrono::system_clock::time_point::min()), nameHash_(0),
+  isPending_(true)
 {
   // Set up timeoutTime_.
   if (interest_->getInterestLifetimeMilliseconds() >= 0.0)
@@ -44,35 +45,394 @@ PendingIncomingInterestTable::Entry::Entry
     timeoutTime_ = chrono::system_clock::time_point::min();
 }
 
+PendingIncomingInterestTable::AddResult
+PendingIncomingInterestTable::add
+  (const ptr_lib::shared_ptr<const Interest>& interest, Face& face)
+{
+  if (!findFaceCounters(&face))
+    // The face was removed, so don't keep a reference to it.
+    return DROPPED;
+
+  removeTimedOutInterests(chrono::system_clock::now());
+
+  makePrefixHashes(interest->getName());
+  size_t nameHash = prefixHashes_[interest->getName().size()];
+  bool hasName;
+  ptr_lib::shared_ptr<Entry> existing = find
+    (interest->getName(), nameHash, face, hasName);
+  if (existing) {
+    if (existing->getInterest()->getNonce().equals(interest->getNonce())) {
+      _LOG_DEBUG("PendingIncomingInterestTable: Dropping duplicate Interest " <<
+                 interest->getName());
+      ++findFaceCounters(&face)->nDroppedInterests_;
+      return DROPPED;
+    }
+
+    // A retransmission. Replace the entry to use the new lifetime.
+    erase(*existing);
+  }
+
+  if (maxEntries_ > 0 && nEntries_ >= maxEntries_) {
+    if (overloadPolicy_ == IncomingInterestOverloadPolicy_DROP_OLDEST) {
+      while (nEntries_ >= maxEntries_) {
+        if (!removeOldest())
+          break;
+      }
+      if (!findFaceCounters(&face))
+        // An onUnsatisfied callback removed the face.
+        return DROPPED;
+      if (hasName)
+        // We may have dropped the other pending Interest with the name.
+        find(interest->getName(), nameHash, face, hasName);
+    }
+    else {
+      if (overloadPolicy_ == IncomingInterestOverloadPolicy_NACK) {
+        try {
+          NetworkNack networkNack;
+          networkNack.setReason(ndn_NetworkNackReason_CONGESTION);
+          face.putNack(*interest, networkNack);
+          ++findFaceCounters(&face)->nOutNacks_;
+        } catch (const std::exception& ex) {
+          _LOG_ERROR("PendingIncomingInterestTable: Error sending Nack: " << ex.what());
+        } catch (...) {
+          _LOG_ERROR("PendingIncomingInterestTable: Error sending Nack.");
+        }
+      }
+
+      _LOG_DEBUG("PendingIncomingInterestTable: The table is full. Rejecting " <<
+                 interest->getName());
+      ++findFaceCounters(&face)->nDroppedInterests_;
+      return DROPPED;
+    }
+  }
+
+  ptr_lib::shared_ptr<Entry> entry = ptr_lib::make_shared<Entry>(interest, face);
+  entry->nameHash_ = nameHash;
+  index_[entry->nameHash_].push_back(entry);
+  if (interest->getCanBePrefix())
+    ++nCanBePrefix_;
+  arrivals_.push_back(entry);
+  if (entry->getTimeoutTime() != chrono::system_clock::time_point::min()) {
+    timeouts_.push(Timeout(entry));
+    scheduleTimer();
+  }
+
+  ++nEntries_;
+  if (nEntries_ > highWaterMark_)
+    highWaterMark_ = nEntries_;
+
+  if (arrivals_.size() > 2 * nEntries_ + 16) {
+    // Remove the entries which are no longer pending so that arrivals_ doesn't
+    // grow behind a long-lived oldest entry.
+    deque<ptr_lib::weak_ptr<Entry>> arrivals;
+    for (size_t i = 0; i < arrivals_.size(); ++i) {
+      ptr_lib::shared_ptr<Entry> arrival = arrivals_[i].lock();
+      if (arrival && arrival->isPending_)
+        arrivals.push_back(arrival);
+    }
+    arrivals_.swap(arrivals);
+  }
+
+  return hasName ? AGGREGATED : ADDED;
+}
+
+void
+PendingIncomingInterestTable::remove(const Interest& interest, const Face& face)
+{
+  makePrefixHashes(interest.getName());
+  bool hasName;
+  ptr_lib::shared_ptr<Entry> entry = find
+    (interest.getName(), prefixHashes_[interest.getName().size()], face,
+     hasName);
+  if (entry && entry->getInterest().get() == &interest)
+    erase(*entry);
+}
+
+void
+PendingIncomingInterestTable::removeFace(const Face* face)
+{
+  map<const Face*, FaceEntry>::iterator faceEntry = faces_.find(face);
+  if (faceEntry == faces_.end())
+    return;
+  if (--faceEntry->second.nRegistrations_ > 0)
+    // Another registration still uses the face.
+    return;
+  faces_.erase(faceEntry);
+
+  // Collect the entries first since erase changes the buckets.
+  vector<ptr_lib::shared_ptr<Entry>> entries;
+  for (unordered_map<size_t, Bucket>::iterator bucket = index_.begin();
+       bucket != index_.end(); ++bucket) {
+    for (size_t i = 0; i < bucket->second.size(); ++i) {
+      if (&bucket->second[i]->getFace() == face)
+        entries.push_back(bucket->second[i]);
+    }
+  }
+  for (size_t i = 0; i < entries.size(); ++i)
+    erase(*entries[i]);
+
+  if (timerFace_ == face) {
+    // onTimer ignores the timer on the removed face, so schedule another.
+    timerFace_ = 0;
+    timerTime_ = chrono::system_clock::time_point::max();
+    scheduleTimer();
+  }
+}
+
 void
-PendingIncomingInterestTable::satisfyInterests(const Data& data)
+PendingIncomingInterestTable::satisfyInterests
+  (const Data& data, const Blob& wireEncoding)
 {
+  chrono::system_clock::time_point nowTime = chrono::system_clock::now();
+  removeTimedOutInterests(nowTime);
+  if (nEntries_ == 0)
+    return;
+
+  MatchList matches;
+  findMatches(data.getName(), 0, matches);
+  sendMatches(matches, &wireEncoding, nowTime);
+}
 
+void
+PendingIncomingInterestTable::satisfyInterests
+  (const vector<ptr_lib::shared_ptr<Data>>& dataList,
+   const vector<Blob>& wireEncodings)
+{
   chrono::system_clock::time_point nowTime = chrono::system_clock::now();
+  removeTimedOutInterests(nowTime);
+  if (nEntries_ == 0 || dataList.size() == 0)
+    return;
+
+  MatchList matches;
+  for (size_t i = 0; i < dataList.size(); ++i)
+    findMatches(dataList[i]->getName(), i, matches);
+  sendMatches(matches, &wireEncodings[0], nowTime);
+}
+
+void
+PendingIncomingInterestTable::findMatches
+  (const Name& dataName, size_t wireEncodingIndex, MatchList& matches)
+{
+  makePrefixHashes(dataName);
+  // Only check shorter prefixes if an Interest can match one.
+  size_t minPrefixLength = (nCanBePrefix_ > 0 ? 0 : dataName.size());
 
-  // Go backwards through the list so we can erase entries.
-  for (int i = (int)table_.size() - 1; i >= 0; --i) {
-    Entry& pendingInterest = *table_[i];
-    if (pendingInterest.isTimedOut(nowTime)) {
-      table_.erase(table_.begin() + i);
+  for (size_t length = minPrefixLength; length <= dataName.size(); ++length) {
+    unordered_map<size_t, Bucket>::iterator bucket =
+      index_.find(prefixHashes_[length]);
+    if (bucket == index_.end())
       continue;
+
+    for (size_t i = 0; i < bucket->second.size(); ++i) {
+      // Check the name in case of a hash collision or an Interest without
+      // CanBePrefix for a prefix.
+      // TODO: Use matchesData to match selectors?
+      if (bucket->second[i]->getInterest()->matchesName(dataName))
+        matches.push_back(make_pair(bucket->second[i], wireEncodingIndex));
     }
+  }
+}
 
-    // TODO: Use matchesData to match selectors?
-    if (pendingInterest.getInterest()->matchesName(data.getName())) {
-      try {
-        // Send to the same face from the original call to the OnInterest
-        // callback. wireEncode returns the cached encoding if available.
-        pendingInterest.getFace().send(data.wireEncode());
-      } catch (const std::exception& ex) {
-        _LOG_ERROR("PendingIncomingInterestTable: Error sending data: " << ex.what());
-      } catch (...) {
-        _LOG_ERROR("PendingIncomingInterestTable: Error sending data.");
-      }
+void
+PendingIncomingInterestTable::sendMatches
+  (const MatchList& matches, const Blob* wireEncodings,
+   chrono::system_clock::time_point nowTimePoint)
+{
+  for (size_t i = 0; i < matches.size(); ++i) {
+    Entry& pendingInterest = *matches[i].first;
+    if (!pendingInterest.isPending_)
+      // Already sent for another Data packet, or found in another bucket with
+      // the same hash.
+      continue;
+    erase(pendingInterest);
+    if (pendingInterest.isTimedOut(nowTimePoint))
+      continue;
 
-      table_.erase(table_.begin() + i);
+    try {
+      // Send to the same face from the original call to the OnInterest
+      // callback.
+      pendingInterest.getFace().send(wireEncodings[matches[i].second]);
+      Namespace::FaceCounters* counters =
+        findFaceCounters(&pendingInterest.getFace());
+      if (counters)
+        ++counters->nOutData_;
+    } catch (const std::exception& ex) {
+      _LOG_ERROR("PendingIncomingInterestTable: Error sending data: " << ex.what());
+    } catch (...) {
+      _LOG_ERROR("PendingIncomingInterestTable: Error sending data.");
     }
   }
 }
 
+void
+PendingIncomingInterestTable::removeTimedOutInterests
+  (chrono::system_clock::time_point nowTimePoint)
+{
+  while (!timeouts_.empty() && timeouts_.top().timeoutTime_ <= nowTimePoint) {
+    ptr_lib::shared_ptr<Entry> entry = timeouts_.top().entry_.lock();
+    // Pop before calling onUnsatisfied_ which may call this again.
+    timeouts_.pop();
+    if (entry && entry->isPending_)
+      removeUnsatisfied(entry);
+  }
+}
+
+ptr_lib::shared_ptr<PendingIncomingInterestTable::Entry>
+PendingIncomingInterestTable::find
+  (const Name& name, size_t nameHash, const Face& face, bool& hasName)
+{
+  hasName = false;
+  unordered_map<size_t, Bucket>::iterator bucket = index_.find(nameHash);
+  if (bucket == index_.end())
+    return ptr_lib::shared_ptr<Entry>();
+
+  ptr_lib::shared_ptr<Entry> result;
+  for (size_t i = 0; i < bucket->second.size(); ++i) {
+    const ptr_lib::shared_ptr<Entry>& entry = bucket->second[i];
+    if (!entry->getInterest()->getName().equals(name))
+      // A hash collision.
+      continue;
+
+    hasName = true;
+    if (&entry->getFace() == &face)
+      result = entry;
+  }
+
+  return result;
+}
+
+void
+PendingIncomingInterestTable::removeUnsatisfied
+  (const ptr_lib::shared_ptr<Entry>& entry)
+{
+  erase(*entry);
+
+  if (onUnsatisfied_) {
+    try {
+      onUnsatisfied_(entry->getInterest());
+    } catch (const std::exception& ex) {
+      _LOG_ERROR("PendingIncomingInterestTable: Error in onUnsatisfied: " <<
+                 ex.what());
+    } catch (...) {
+      _LOG_ERROR("PendingIncomingInterestTable: Error in onUnsatisfied.");
+    }
+  }
+}
+
+bool
+PendingIncomingInterestTable::removeOldest()
+{
+  while (!arrivals_.empty()) {
+    ptr_lib::shared_ptr<Entry> entry = arrivals_.front().lock();
+    arrivals_.pop_front();
+    if (entry && entry->isPending_) {
+      _LOG_DEBUG("PendingIncomingInterestTable: The table is full. Dropping " <<
+                 entry->getInterest()->getName());
+      removeUnsatisfied(entry);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+PendingIncomingInterestTable::scheduleTimer()
+{
+  // Skip the entries which were already satisfied.
+  while (!timeouts_.empty()) {
+    ptr_lib::shared_ptr<Entry> entry = timeouts_.top().entry_.lock();
+    if (entry && entry->isPending_)
+      break;
+    timeouts_.pop();
+  }
+
+  if (timeouts_.empty() || timeouts_.top().timeoutTime_ >= timerTime_)
+    // No timeout, or the pending timer will fire first and schedule this one.
+    return;
+
+  ptr_lib::shared_ptr<Entry> entry = timeouts_.top().entry_.lock();
+  chrono::nanoseconds delay = chrono::duration_cast<chrono::nanoseconds>
+    (timeouts_.top().timeoutTime_ - chrono::system_clock::now());
+  if (delay.count() < 0)
+    delay = chrono::nanoseconds(0);
+  timerTime_ = timeouts_.top().timeoutTime_;
+  const Face* face = &entry->getFace();
+  timerFace_ = face;
+
+  // Use a weak pointer so that the Face doesn't keep this table.
+  ptr_lib::weak_ptr<PendingIncomingInterestTable> table = shared_from_this();
+  entry->getFace().callLater(delay, [=] {
+    ptr_lib::shared_ptr<PendingIncomingInterestTable> lockedTable = table.lock();
+    if (lockedTable)
+      lockedTable->onTimer(face);
+  });
+}
+
+void
+PendingIncomingInterestTable::onTimer(const Face* face)
+{
+  if (faces_.find(face) == faces_.end())
+    // The face was removed, and removeFace scheduled another timer.
+    return;
+
+  chrono::system_clock::time_point now = chrono::system_clock::now();
+  if (now >= timerTime_)
+    // This is the pending timer. (An earlier timer may fire late.)
+    timerTime_ = chrono::system_clock::time_point::max();
+  removeTimedOutInterests(now);
+
+  scheduleTimer();
+}
+
+void
+PendingIncomingInterestTable::makePrefixHashes(const Name& name)
+{
+  prefixHashes_.resize(name.size() + 1);
+  // Extend the hash with each component, using FNV-1a on the value bytes and
+  // the component length so that adjacent components can't run together.
+  uint64_t hash = 14695981039346656037ULL;
+  prefixHashes_[0] = (size_t)hash;
+  for (size_t i = 0; i < name.size(); ++i) {
+    const Blob& value = name.get(i).getValue();
+    const uint8_t* buf = value.buf();
+    for (size_t j = 0; j < value.size(); ++j) {
+      hash ^= buf[j];
+      hash *= 1099511628211ULL;
+    }
+    hash ^= value.size();
+    hash *= 1099511628211ULL;
+
+    prefixHashes_[i + 1] = (size_t)hash;
+  }
+}
+
+void
+PendingIncomingInterestTable::erase(Entry& entry)
+{
+  if (!entry.isPending_)
+    return;
+  entry.isPending_ = false;
+
+  unordered_map<size_t, Bucket>::iterator bucket = index_.find(entry.nameHash_);
+  if (bucket != index_.end()) {
+    Bucket& entries = bucket->second;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].get() == &entry) {
+        // The order in the bucket doesn't matter, so move the last one here.
+        entries[i] = entries.back();
+        entries.pop_back();
+        break;
+      }
+    }
+
+    if (entries.size() == 0)
+      index_.erase(bucket);
+  }
+
+  if (entry.interest_->getCanBePrefix())
+    --nCanBePrefix_;
+  --nEntries_;
+}
+
 }
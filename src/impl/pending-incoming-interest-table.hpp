@@ -22,16 +22,30 @@
 #ifndef NDN_PENDING_INCOMING_INTEREST_TABLE_HPP
 #define NDN_PENDING_INCOMING_INTEREST_TABLE_HPP
 
+#include <deque>
+#include <map>
+#include <queue>
+#include <unordered_map>
 #include <ndn-ind/face.hpp>
+#include <cnl-cpp/namespace.hpp>
 
 namespace cnl_cpp {
 
 /**
  * PendingImcomingInterestTable is an internal class to hold a list of
- * Interests which OnInterest received but could not satisfy.
+ * Interests which OnInterest received but could not satisfy. The entries are
+ * indexed by a hash of the Interest name so that satisfyInterests only checks
+ * the Interests whose name is the Data name or (for CanBePrefix) a prefix of
+ * it. Timed-out entries are removed in order of their timeout time by a timer
+ * on the Face of the entry.
  */
-class PendingIncomingInterestTable {
+class PendingIncomingInterestTable
+  : public ndn::ptr_lib::enable_shared_from_this<PendingIncomingInterestTable> {
 public:
+  typedef ndn::func_lib::function<void
+    (const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest)>
+    OnUnsatisfied;
+
   /**
    * Entry holds the Interest and other fields for an entry in the pending
    * interest table.
@@ -77,41 +91,320 @@ public:
              nowTimePoint >= timeoutTime_;
     }
 
+    /**
+     * Get the timeout time set by the constructor.
+     * @return The timeout time, or time_point::min() for no timeout.
+     */
+    std::chrono::system_clock::time_point
+    getTimeoutTime() const { return timeoutTime_; }
+
   private:
+    friend class PendingIncomingInterestTable;
+
     ndn::ptr_lib::shared_ptr<const ndn::Interest> interest_;
     ndn::Face& face_;
     std::chrono::system_clock::time_point timeoutTime_;
+    // The hash of the Interest name, which is the key in the index.
+    size_t nameHash_;
+    // False if the entry was satisfied or removed from the table.
+    bool isPending_;
   };
 
+  /**
+   * The result of add().
+   */
+  enum AddResult {
+    // The Interest was added and no other Interest with its name is pending.
+    ADDED,
+    // The Interest was added, and another Interest with its name is pending.
+    AGGREGATED,
+    // The Interest is a duplicate or was rejected because the table is full.
+    DROPPED
+  };
+
+  /**
+   * Create a PendingIncomingInterestTable.
+   * @param onUnsatisfied When an entry times out or is dropped by the overload
+   * policy, this calls onUnsatisfied(interest). If onUnsatisfied is an empty
+   * OnUnsatisfied(), this does not use it.
+   */
+  PendingIncomingInterestTable(const OnUnsatisfied& onUnsatisfied)
+  : onUnsatisfied_(onUnsatisfied), nEntries_(0), highWaterMark_(0),
+    nCanBePrefix_(0), maxEntries_(0),
+    overloadPolicy_(IncomingInterestOverloadPolicy_DROP_OLDEST),
+    timerTime_(std::chrono::system_clock::time_point::max()), timerFace_(0)
+  {}
+
   /**
    * Store an interest from an OnInterest callback in the internal pending
-   * interest table. Use satisfyInterests(data) to check if the Data packet
+   * interest table. Use satisfyInterests to check if the Data packet
    * satisfies any pending interest.
    * @param interest The Interest for which we don't have a Data packet yet.
    * You should not modify the interest after calling this.
    * @param face The Face from the OnInterest callback with the connection which
    * received the Interest and to which satisfyInterests will send the Data
-   * packet.
+   * packet. If there is already a pending Interest with the same name on the
+   * same face, then this aggregates them: If the nonce is the same, then the
+   * new Interest is a duplicate (for example, from a loop) and is dropped.
+   * Otherwise it is a retransmission and replaces the existing entry so that
+   * the Data packet is sent to the face only once.
+   * @return ADDED if the Interest was added and is the only pending Interest
+   * with its name, AGGREGATED if it was added (or replaced a retransmitted
+   * Interest) and other Interests with its name are pending, or DROPPED if it
+   * is a duplicate or the table is full and the overload policy rejected it
+   * (and sent a Nack if the policy is IncomingInterestOverloadPolicy_NACK).
    */
-  void
+  AddResult
   add
     (const ndn::ptr_lib::shared_ptr<const ndn::Interest>& interest,
-     ndn::Face& face)
-  {
-    table_.push_back(ndn::ptr_lib::make_shared<Entry>(interest, face));
-  }
+     ndn::Face& face);
+
+  /**
+   * Remove the pending entry for the Interest from the face, for example if
+   * add() returned ADDED but no producer will be asked for the Data packet.
+   * This does not call onUnsatisfied.
+   * @param interest The Interest given to add().
+   * @param face The face given to add().
+   */
+  void
+  remove(const ndn::Interest& interest, const ndn::Face& face);
 
   /**
    * Remove timed-out Interests, then for each pending Interest that the Data
    * packet matches, send the Data packet through the face and remove the
    * pending Interest.
    * @param data The Data packet to send if it satisfies an Interest.
+   * @param wireEncoding The wire encoding of the Data packet, which is sent
+   * to each face without encoding again.
+   */
+  void
+  satisfyInterests(const ndn::Data& data, const ndn::Blob& wireEncoding);
+
+  /**
+   * Remove timed-out Interests, then find the pending Interests that the Data
+   * packets match in one pass, and send the Data packets through the faces
+   * and remove the pending Interests. If more than one Data packet matches an
+   * Interest (with CanBePrefix), send the first one.
+   * @param dataList The Data packets to send if they satisfy an Interest.
+   * @param wireEncodings The wire encoding of each Data packet in dataList.
+   */
+  void
+  satisfyInterests
+    (const std::vector<ndn::ptr_lib::shared_ptr<ndn::Data>>& dataList,
+     const std::vector<ndn::Blob>& wireEncodings);
+
+  /**
+   * Remove the entries whose Interest is timed out.
+   * @param nowTimePoint The current time.
+   */
+  void
+  removeTimedOutInterests(std::chrono::system_clock::time_point nowTimePoint);
+
+  /**
+   * Get the number of pending Interests in the table. This may include
+   * timed-out Interests which have not been removed yet.
+   * @return The number of pending Interests.
+   */
+  size_t
+  size() const { return nEntries_; }
+
+  /**
+   * Get the largest number of pending Interests that the table has held at
+   * one time.
+   * @return The high-water mark.
+   */
+  size_t
+  getHighWaterMark() const { return highWaterMark_; }
+
+  /**
+   * Add the face which receives Interests for the table, and create its
+   * counters if needed. Each call must be matched by a call to removeFace.
+   * @param face The face which registered a prefix for the OnInterest
+   * callback.
+   */
+  void
+  addFace(const ndn::Face* face) { ++faces_[face].nRegistrations_; }
+
+  /**
+   * Undo one call to addFace. When the face has no more registrations, remove
+   * its pending entries (without calling onUnsatisfied) and its counters, so
+   * that the table no longer uses the face. If the timer was scheduled on the
+   * face, schedule it again on the face of another entry.
+   * @param face The face given to addFace.
    */
   void
-  satisfyInterests(const ndn::Data& data);
+  removeFace(const ndn::Face* face);
+
+  /**
+   * Find the counters for the face.
+   * @param face The face.
+   * @return The FaceCounters, which the caller can update, or null if the
+   * face was not added with addFace.
+   */
+  Namespace::FaceCounters*
+  findFaceCounters(const ndn::Face* face)
+  {
+    std::map<const ndn::Face*, FaceEntry>::iterator faceEntry =
+      faces_.find(face);
+    return faceEntry == faces_.end() ? 0 : &faceEntry->second.counters_;
+  }
+
+  /**
+   * Set the maximum number of entries and the policy for an Interest which
+   * arrives when the table is full.
+   * @param maxEntries The maximum number of entries, or 0 for no limit.
+   * @param overloadPolicy The IncomingInterestOverloadPolicy.
+   */
+  void
+  setMaxEntries
+    (size_t maxEntries, IncomingInterestOverloadPolicy overloadPolicy)
+  {
+    maxEntries_ = maxEntries;
+    overloadPolicy_ = overloadPolicy;
+  }
 
 private:
-  std::vector<ndn::ptr_lib::shared_ptr<Entry> > table_;
+  /**
+   * A FaceEntry holds the counters of a face from addFace and the number of
+   * times it was added.
+   */
+  class FaceEntry {
+  public:
+    FaceEntry()
+    : nRegistrations_(0)
+    {}
+
+    Namespace::FaceCounters counters_;
+    size_t nRegistrations_;
+  };
+
+  /**
+   * A Timeout holds the timeout time of an entry for the timeouts_ min-heap.
+   * The entry is a weak pointer so that the heap doesn't keep a satisfied
+   * entry until its timeout.
+   */
+  class Timeout {
+  public:
+    Timeout(const ndn::ptr_lib::shared_ptr<Entry>& entry)
+    : timeoutTime_(entry->getTimeoutTime()), entry_(entry)
+    {}
+
+    bool
+    operator > (const Timeout& other) const
+    {
+      return timeoutTime_ > other.timeoutTime_;
+    }
+
+    std::chrono::system_clock::time_point timeoutTime_;
+    ndn::ptr_lib::weak_ptr<Entry> entry_;
+  };
+
+  typedef std::vector<ndn::ptr_lib::shared_ptr<Entry>> Bucket;
+  // The matched entry and the index of the wire encoding to send.
+  typedef std::vector<std::pair<ndn::ptr_lib::shared_ptr<Entry>, size_t>>
+    MatchList;
+
+  /**
+   * Append the pending entries whose Interest matches the Data name.
+   * @param dataName The Data packet name.
+   * @param wireEncodingIndex The index of the wire encoding to send, which is
+   * paired with each matched entry.
+   * @param matches Append the matches to this.
+   */
+  void
+  findMatches
+    (const ndn::Name& dataName, size_t wireEncodingIndex, MatchList& matches);
+
+  /**
+   * Erase each matched entry and send the wire encoding to its face. Skip an
+   * entry which was already erased.
+   * @param matches The matches from findMatches.
+   * @param wireEncodings The wire encodings referenced by matches.
+   * @param nowTimePoint The current time, to skip timed-out entries.
+   */
+  void
+  sendMatches
+    (const MatchList& matches, const ndn::Blob* wireEncodings,
+     std::chrono::system_clock::time_point nowTimePoint);
+
+  /**
+   * Set prefixHashes_[i] to the hash of the first i components of the name,
+   * for i from 0 to name.size().
+   * @param name The name.
+   */
+  void
+  makePrefixHashes(const ndn::Name& name);
+
+  /**
+   * Erase the entry from its bucket in index_ and mark it not pending.
+   * @param entry The entry to erase.
+   */
+  void
+  erase(Entry& entry);
+
+  /**
+   * Find the pending entry with the Interest name on the face.
+   * @param name The Interest name.
+   * @param nameHash The hash of the name from makePrefixHashes.
+   * @param face The face from the OnInterest callback.
+   * @param hasName Set this true if there is a pending entry with the Interest
+   * name on any face, otherwise false.
+   * @return The entry, or null if not found.
+   */
+  ndn::ptr_lib::shared_ptr<Entry>
+  find
+    (const ndn::Name& name, size_t nameHash, const ndn::Face& face,
+     bool& hasName);
+
+  /**
+   * Erase the entry and call onUnsatisfied_.
+   * @param entry The entry to remove.
+   */
+  void
+  removeUnsatisfied(const ndn::ptr_lib::shared_ptr<Entry>& entry);
+
+  /**
+   * Erase the oldest pending entry to make room for a new one.
+   * @return True if an entry was removed, false if none.
+   */
+  bool
+  removeOldest();
+
+  /**
+   * If the earliest timeout in timeouts_ is before timerTime_, schedule the
+   * timer on the Face of its entry.
+   */
+  void
+  scheduleTimer();
+
+  /**
+   * This is called by the Face when the timer from scheduleTimer fires.
+   * @param face The face on which the timer was scheduled.
+   */
+  void
+  onTimer(const ndn::Face* face);
+
+  // The key is the hash of the Interest name.
+  std::unordered_map<size_t, Bucket> index_;
+  std::priority_queue
+    <Timeout, std::vector<Timeout>, std::greater<Timeout>> timeouts_;
+  size_t nEntries_;
+  size_t highWaterMark_;
+  // The number of entries whose Interest has CanBePrefix.
+  size_t nCanBePrefix_;
+  // Reused by makePrefixHashes to avoid allocating for each Data packet.
+  std::vector<size_t> prefixHashes_;
+  OnUnsatisfied onUnsatisfied_;
+  size_t maxEntries_; // 0 for no limit.
+  IncomingInterestOverloadPolicy overloadPolicy_;
+  // The entries in the order they were added, for removeOldest. This may have
+  // entries which are no longer pending.
+  std::deque<ndn::ptr_lib::weak_ptr<Entry>> arrivals_;
+  // The time of the pending timer, or max() if none.
+  std::chrono::system_clock::time_point timerTime_;
+  // The face on which scheduleTimer scheduled the pending timer.
+  const ndn::Face* timerFace_;
+  std::map<const ndn::Face*, FaceEntry> faces_;
 };
 
 }
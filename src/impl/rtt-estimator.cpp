@@ -0,0 +1,62 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#include <algorithm>
+#include "rtt-estimator.hpp"
+
+using namespace std;
+
+namespace cnl_cpp {
+
+void
+RttEstimator::addMeasurement(chrono::nanoseconds rtt)
+{
+  if (smoothedRtt_.count() < 0) {
+    // The first measurement.
+    smoothedRtt_ = rtt;
+    rttVariation_ = rtt / 2;
+  }
+  else {
+    // Use alpha = 1/8 and beta = 1/4 from RFC 6298. Update the variation first
+    // since it uses the previous smoothed RTT.
+    chrono::nanoseconds error = smoothedRtt_ - rtt;
+    if (error.count() < 0)
+      error = -error;
+    rttVariation_ = (rttVariation_ * 3 + error) / 4;
+    smoothedRtt_ = (smoothedRtt_ * 7 + rtt) / 8;
+  }
+
+  rto_ = max(minRto_, min(maxRto_, smoothedRtt_ + rttVariation_ * 4));
+  lastBackoffTime_ = chrono::steady_clock::time_point::min();
+}
+
+void
+RttEstimator::backoffRto(chrono::steady_clock::time_point interestSendTime)
+{
+  if (interestSendTime < lastBackoffTime_)
+    // The Interest was in flight when we last backed off.
+    return;
+
+  rto_ = min(maxRto_, rto_ * 2);
+  lastBackoffTime_ = chrono::steady_clock::now();
+}
+
+}
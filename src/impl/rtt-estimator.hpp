@@ -0,0 +1,108 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#ifndef CNL_CPP_RTT_ESTIMATOR_HPP
+#define CNL_CPP_RTT_ESTIMATOR_HPP
+
+#include <chrono>
+
+namespace cnl_cpp {
+
+/**
+ * RttEstimator is an internal class to estimate the round-trip time of
+ * Interests and compute the retransmission timeout as described in RFC 6298.
+ * By Karn's algorithm, the caller should not add a measurement for a Data
+ * packet which answers a retransmitted Interest, since it is ambiguous which
+ * Interest it answers.
+ */
+class RttEstimator {
+public:
+  /**
+   * Create an RttEstimator with no measurements.
+   * @param initialRto (optional) The retransmission timeout before the first
+   * measurement. If omitted, use 1 second from RFC 6298.
+   * @param minRto (optional) The minimum retransmission timeout. If omitted,
+   * use 200 milliseconds.
+   * @param maxRto (optional) The maximum retransmission timeout. If omitted,
+   * use 60 seconds.
+   */
+  RttEstimator
+    (std::chrono::nanoseconds initialRto = std::chrono::seconds(1),
+     std::chrono::nanoseconds minRto = std::chrono::milliseconds(200),
+     std::chrono::nanoseconds maxRto = std::chrono::seconds(60))
+  : smoothedRtt_(-1), rttVariation_(-1), rto_(initialRto), minRto_(minRto),
+    maxRto_(maxRto),
+    lastBackoffTime_(std::chrono::steady_clock::time_point::min())
+  {}
+
+  /**
+   * Update the smoothed RTT and RTT variation with a new measurement and
+   * recompute the retransmission timeout, which cancels any backoff.
+   * @param rtt The measured round-trip time.
+   */
+  void
+  addMeasurement(std::chrono::nanoseconds rtt);
+
+  /**
+   * Double the retransmission timeout after a timeout, up to the maximum.
+   * When many Interests in flight time out together, only back off once:
+   * Don't back off for an Interest which was sent before the last backoff,
+   * since it used the timeout which was already doubled.
+   * @param interestSendTime The time that the timed-out Interest was sent.
+   */
+  void
+  backoffRto(std::chrono::steady_clock::time_point interestSendTime);
+
+  /**
+   * Get the smoothed round-trip time.
+   * @return The smoothed RTT, or a negative value if there is no measurement.
+   */
+  std::chrono::nanoseconds
+  getSmoothedRtt() const { return smoothedRtt_; }
+
+  /**
+   * Get the round-trip time variation.
+   * @return The RTT variation, or a negative value if there is no measurement.
+   */
+  std::chrono::nanoseconds
+  getRttVariation() const { return rttVariation_; }
+
+  /**
+   * Get the current retransmission timeout.
+   * @return The retransmission timeout.
+   */
+  std::chrono::nanoseconds
+  getRto() const { return rto_; }
+
+private:
+  std::chrono::nanoseconds smoothedRtt_;
+  std::chrono::nanoseconds rttVariation_;
+  std::chrono::nanoseconds rto_;
+  std::chrono::nanoseconds minRto_;
+  std::chrono::nanoseconds maxRto_;
+  // The time of the last backoff since the last measurement, or min() if
+  // none.
+  std::chrono::steady_clock::time_point lastBackoffTime_;
+};
+
+}
+
+#endif
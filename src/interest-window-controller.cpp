@@ -0,0 +1,153 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil -*- */
+/**
+ * Copyright (C) 2020 Regents of the University of California.
+ * @author: Jeff Thompson <jefft0@remap.ucla.edu>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version, with the additional exemption that
+ * compiling, linking, and/or using OpenSSL is allowed.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * A copy of the GNU Lesser General Public License is in the file COPYING.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <cnl-cpp/interest-window-controller.hpp>
+
+using namespace std;
+
+namespace cnl_cpp {
+
+InterestWindowController::InterestWindowController
+  (double initialWindow, double maxWindow)
+: window_(initialWindow < 1 ? 1 : initialWindow), maxWindow_(maxWindow),
+  // Allow the first congestion signal to decrease the window.
+  nDataSinceDecrease_((int)window_),
+  retransmissionTimeout_(chrono::seconds(1))
+{
+  if (maxWindow_ < window_)
+    maxWindow_ = window_;
+}
+
+InterestWindowController::~InterestWindowController() {}
+
+void
+InterestWindowController::onData()
+{
+  ++nDataSinceDecrease_;
+  increase();
+  window_ = min(window_, maxWindow_);
+}
+
+void
+InterestWindowController::onCongestionMark()
+{
+  // The Data packet still arrived, so count it for the decrease interval.
+  ++nDataSinceDecrease_;
+  onCongestion();
+}
+
+void
+InterestWindowController::onCongestionNack() { onCongestion(); }
+
+void
+InterestWindowController::onTimeout() { onCongestion(); }
+
+void
+InterestWindowController::onCongestion()
+{
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (nDataSinceDecrease_ < (int)window_ &&
+      now - lastDecreaseTime_ < retransmissionTimeout_)
+    // Already decreased for Interests sent in the same window. If Data packets
+    // stopped arriving, wait for the retransmission timeout to decrease again.
+    return;
+
+  nDataSinceDecrease_ = 0;
+  lastDecreaseTime_ = now;
+  decrease();
+  window_ = max(window_, 1.0);
+}
+
+void
+FixedInterestWindowController::increase() {}
+
+void
+FixedInterestWindowController::decrease() {}
+
+AimdInterestWindowController::AimdInterestWindowController
+  (double initialWindow, double maxWindow, double decreaseFactor)
+: InterestWindowController(initialWindow, maxWindow),
+  decreaseFactor_(decreaseFactor), slowStartThreshold_(getMaxWindow())
+{
+}
+
+void
+AimdInterestWindowController::increase()
+{
+  if (window_ < slowStartThreshold_)
+    window_ += 1;
+  else
+    window_ += 1 / window_;
+}
+
+void
+AimdInterestWindowController::decrease()
+{
+  window_ = max(window_ * decreaseFactor_, 1.0);
+  slowStartThreshold_ = window_;
+}
+
+CubicInterestWindowController::CubicInterestWindowController
+  (double initialWindow, double maxWindow, double decreaseFactor,
+   double cubicFactor)
+: InterestWindowController(initialWindow, maxWindow),
+  decreaseFactor_(decreaseFactor), cubicFactor_(cubicFactor),
+  slowStartThreshold_(getMaxWindow()), lastMaxWindow_(0), k_(0)
+{
+}
+
+void
+CubicInterestWindowController::increase()
+{
+  if (window_ < slowStartThreshold_) {
+    window_ += 1;
+    return;
+  }
+
+  double t = chrono::duration<double>
+    (chrono::steady_clock::now() - epochStart_).count();
+  double target = cubicFactor_ * pow(t - k_, 3) + lastMaxWindow_;
+  if (target > window_)
+    // Spread the increase to the target over one window of Data packets.
+    window_ += (target - window_) / window_;
+  else
+    // Near the plateau, so probe slowly.
+    window_ += 0.01 / window_;
+}
+
+void
+CubicInterestWindowController::decrease()
+{
+  epochStart_ = chrono::steady_clock::now();
+  if (window_ < lastMaxWindow_)
+    // Fast convergence: Release bandwidth for new flows.
+    lastMaxWindow_ = window_ * (1 + decreaseFactor_) / 2;
+  else
+    lastMaxWindow_ = window_;
+
+  window_ = max(window_ * decreaseFactor_, 1.0);
+  slowStartThreshold_ = window_;
+  k_ = cbrt(lastMaxWindow_ * (1 - decreaseFactor_) / cubicFactor_);
+}
+
+}
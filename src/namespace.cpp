@@ -20,9 +20,12 @@
  */
 
 #include <sstream>
-#include <ndn-ind/util/exponential-re-express.hpp>
+#include <algorithm>
 #include <ndn-ind/util/logging.hpp>
 #include "impl/pending-incoming-interest-table.hpp"
+#include "impl/outgoing-interest-table.hpp"
+#include "impl/rtt-estimator.hpp"
+#include "impl/namespace-node-pool.hpp"
 #include <cnl-cpp/namespace.hpp>
 
 using namespace std;
@@ -33,6 +36,43 @@ INIT_LOGGER("cnl_cpp.Namespace");
 
 namespace cnl_cpp {
 
+/**
+ * NamespaceNodeDeleter is the shared_ptr deleter for a child Namespace which
+ * Impl::createChild constructed in storage from the root's NamespaceNodePool.
+ */
+class NamespaceNodeDeleter {
+public:
+  NamespaceNodeDeleter(const ptr_lib::shared_ptr<NamespaceNodePool>& nodePool)
+  : nodePool_(nodePool)
+  {}
+
+  void
+  operator() (Namespace* nameSpace)
+  {
+    nameSpace->~Namespace();
+    nodePool_->deallocate(nameSpace, sizeof(Namespace));
+    nodePool_->updateNNodes(-1);
+  }
+
+private:
+  ptr_lib::shared_ptr<NamespaceNodePool> nodePool_;
+};
+
+Namespace::Namespace
+  (const ptr_lib::shared_ptr<NamespaceNodePool>& nodePool,
+   const ptr_lib::shared_ptr<bool>& isShutDown)
+: impl_(ptr_lib::allocate_shared<Impl>
+        (NamespaceNodeAllocator<Impl>(nodePool), *this, Name(), (KeyChain*)0,
+         isShutDown))
+{
+}
+
+Namespace::~Namespace()
+{
+  // A callback may hold the Impl after this node is removed from the tree.
+  impl_->onNamespaceDeleted();
+}
+
 Namespace::Handler&
 Namespace::Handler::setNamespace(Namespace* nameSpace)
 {
@@ -70,14 +110,94 @@ Namespace::getNextCallbackId()
 Namespace::Impl::Impl
   (Namespace& outerNamespace, const Name& name, KeyChain* keyChain,
    const ndn::ptr_lib::shared_ptr<bool>& isShutDown)
-: outerNamespace_(outerNamespace), name_(name), keyChain_(keyChain), parent_(0),
+: outerNamespace_(outerNamespace), name_(name), depth_(name.size()),
+  keyChain_(keyChain), parent_(0),
   root_(this), state_(NamespaceState_NAME_EXISTS),
   validateState_(NamespaceValidateState_WAITING_FOR_DATA),
   freshnessExpiryTime_(chrono::system_clock::time_point::min()),
+  negativeCacheExpiryTime_(chrono::system_clock::time_point::min()),
+  nNegativeCacheFailures_(0), negativeCacheState_(NamespaceState_NAME_EXISTS),
+  canMeasureRtt_(false), interestSerial_(0), isStale_(false),
+  nDataNodes_(0), maxDataDepth_(0),
   face_(0), decryptor_(0),
-  maxInterestLifetime_(-1), syncDepth_(-1), registeredPrefixId_(0),
-  isShutDown_(isShutDown)
+  maxInterestLifetime_(-1), negativeCacheTtl_(-1), syncDepth_(-1),
+  registeredPrefixId_(0),
+  inheritedSettingsEpoch_(0), inheritedFace_(0),
+  inheritedKeyChain_(0), inheritedDecryptor_(0), inheritedNewDataMetaInfo_(0),
+  inheritedMaxInterestLifetime_(-1), inheritedNegativeCacheTtl_(-1),
+  inheritedSyncNode_(0),
+  payloadBytes_(0), olderPayload_(0), newerPayload_(0), isInPayloadList_(false),
+  isInBatch_(false), isDeleted_(false), onStateChangedStateMask_(0),
+  onValidateStateChangedStateMask_(0), nearestListenersEpoch_(0),
+  isShutDown_(isShutDown), isSortedChildrenValid_(true)
+{
+  if (name.size() > 0)
+    component_ = name[-1];
+
+  if (!isShutDown_) {
+    // This is the root node.
+    isShutDown_ = ptr_lib::make_shared<bool>(false);
+    rootState_.reset(new RootState());
+  }
+}
+
+Namespace::Impl::~Impl()
+{
+  if (rootState_) {
+    // Empty the payload list first so that nodes which are destroyed after
+    // this root don't try to update it.
+    Namespace::Impl* impl = rootState_->oldestPayload_;
+    while (impl) {
+      Namespace::Impl* newer = impl->newerPayload_;
+      impl->olderPayload_ = 0;
+      impl->newerPayload_ = 0;
+      impl->isInPayloadList_ = false;
+      impl = newer;
+    }
+    rootState_->oldestPayload_ = 0;
+    rootState_->newestPayload_ = 0;
+  }
+  else
+    unlinkPayload();
+
+  clearSpeculative();
+}
+
+Name
+Namespace::Impl::buildName() const
+{
+  // Collect the components up to the root, which has its full name.
+  vector<const Name::Component*> components;
+  const Namespace::Impl* impl = this;
+  while (impl->parent_) {
+    components.push_back(&impl->component_);
+    impl = impl->parent_;
+  }
+
+  Name result(impl->name_);
+  for (vector<const Name::Component*>::reverse_iterator component =
+         components.rbegin();
+       component != components.rend(); ++component)
+    result.append(**component);
+
+  return result;
+}
+
+bool
+Namespace::Impl::isPrefixOfName(const Name& name) const
 {
+  if (depth_ > name.size())
+    return false;
+
+  // Compare by position up to the root, which has its full name.
+  const Namespace::Impl* impl = this;
+  while (impl->parent_) {
+    if (!impl->component_.equals(name[impl->depth_ - 1]))
+      return false;
+    impl = impl->parent_;
+  }
+
+  return impl->name_.isPrefixOf(name);
 }
 
 Namespace*
@@ -87,7 +207,7 @@ Namespace::Impl::getParent()
     throw runtime_error
       ("Cannot get the parent of this Namespace node because it is shut down");
 
-  return &parent_->outerNamespace_;
+  return parent_ ? &parent_->outerNamespace_ : 0;
 }
 
 Namespace*
@@ -103,11 +223,11 @@ Namespace::Impl::getRoot()
 bool
 Namespace::Impl::hasChild(const Name& descendantName)
 {
-  if (!name_.isPrefixOf(descendantName))
+  if (!isPrefixOfName(descendantName))
     throw runtime_error
       ("The name of this node is not a prefix of the descendant name");
 
-  if (descendantName.size() == name_.size())
+  if (descendantName.size() == depth_)
     // A trivial case where it is already the name of this node.
     return true;
 
@@ -117,21 +237,22 @@ Namespace::Impl::hasChild(const Name& descendantName)
   Namespace::Impl* descendantImpl = this;
   while (true) {
     const Name::Component& nextComponent =
-      descendantName[descendantImpl->name_.size()];
+      descendantName[descendantImpl->depth_];
     if (!descendantImpl->hasChild(nextComponent))
       return false;
 
-    if (descendantImpl->name_.size() + 1 == descendantName.size())
+    if (descendantImpl->depth_ + 1 == descendantName.size())
       // nextComponent is the final component.
       return true;
-    descendantImpl = descendantImpl->children_[nextComponent]->impl_.get();
+    descendantImpl =
+      descendantImpl->children_.find(nextComponent)->second->impl_.get();
   }
 }
 
 Namespace::Impl&
 Namespace::Impl::getChildImpl(const Name& descendantName)
 {
-  if (!name_.isPrefixOf(descendantName))
+  if (!isPrefixOfName(descendantName))
     throw runtime_error
       ("The name of this node is not a prefix of the descendant name");
 
@@ -139,18 +260,17 @@ Namespace::Impl::getChildImpl(const Name& descendantName)
   // the name of the descendant Namespace is a prefix, so we can just go by
   // component count instead of a full compare.
   Namespace::Impl* descendantImpl = this;
-  while (descendantImpl->name_.size() < descendantName.size()) {
+  while (descendantImpl->depth_ < descendantName.size()) {
     const Name::Component& nextComponent =
-      descendantName[descendantImpl->name_.size()];
+      descendantName[descendantImpl->depth_];
 
-    map<Name::Component, ptr_lib::shared_ptr<Namespace>>::iterator
-      child = descendantImpl->children_.find(nextComponent);
+    ChildMap::iterator child = descendantImpl->children_.find(nextComponent);
     if (child != descendantImpl->children_.end())
       descendantImpl = child->second->impl_.get();
     else {
       // Only fire the callbacks for the leaf node.
       bool isLeaf =
-        (descendantImpl->name_.size() == descendantName.size() - 1);
+        (descendantImpl->depth_ == descendantName.size() - 1);
       descendantImpl = descendantImpl->createChild
         (nextComponent, isLeaf).impl_.get();
     }
@@ -162,15 +282,35 @@ Namespace::Impl::getChildImpl(const Name& descendantName)
 ptr_lib::shared_ptr<vector<Name::Component>>
 Namespace::Impl::getChildComponents()
 {
+  const vector<Namespace::Impl*>& sortedChildren = getSortedChildren();
   ptr_lib::shared_ptr<vector<Name::Component>> result =
     ptr_lib::make_shared<vector<Name::Component>>();
-  for (map<Name::Component, ptr_lib::shared_ptr<Namespace>>::iterator i = children_.begin();
-       i != children_.end(); ++i)
-    result->push_back(i->first);
+  result->reserve(sortedChildren.size());
+  for (size_t i = 0; i < sortedChildren.size(); ++i)
+    result->push_back(sortedChildren[i]->component_);
 
   return result;
 }
 
+const vector<Namespace::Impl*>&
+Namespace::Impl::getSortedChildren()
+{
+  if (!isSortedChildrenValid_) {
+    sortedChildren_.clear();
+    sortedChildren_.reserve(children_.size());
+    for (ChildMap::iterator i = children_.begin(); i != children_.end(); ++i)
+      sortedChildren_.push_back(i->second->impl_.get());
+
+    sort(sortedChildren_.begin(), sortedChildren_.end(),
+         [](Namespace::Impl* a, Namespace::Impl* b) {
+           return a->component_.compare(b->component_) < 0;
+         });
+    isSortedChildrenValid_ = true;
+  }
+
+  return sortedChildren_;
+}
+
 void
 Namespace::Impl::serializeObject(const ptr_lib::shared_ptr<Object>& object)
 {
@@ -192,12 +332,12 @@ Namespace::Impl::serializeObject(const ptr_lib::shared_ptr<Object>& object)
   if (!keyChain)
     throw runtime_error
       ("serializeObject: There is no KeyChain, so can't serialize " +
-       name_.toUri());
+       getName().toUri());
 
   // TODO: Encrypt and set state ENCRYPTING.
 
   // Prepare the Data packet.
-  ptr_lib::shared_ptr<Data> data = ptr_lib::make_shared<Data>(name_);
+  ptr_lib::shared_ptr<Data> data = ptr_lib::make_shared<Data>(buildName());
   data->setContent(blobObject->getBlob());
   const MetaInfo* metaInfo = getNewDataMetaInfo_();
   if (metaInfo)
@@ -224,27 +364,91 @@ Namespace::Impl::setData(const ptr_lib::shared_ptr<Data>& data)
   if (getIsShutDown())
     return false;
 
-  if (data_)
-    // We already have an attached object.
+  if (data_ && !isStale_)
+    // We already have an attached object. (A stale one can be replaced.)
     return false;
-  if (!data->getName().equals(name_))
+  if (!nameEquals(data->getName()))
     throw runtime_error
       ("The Data packet name does not equal the name of this Namespace node");
 
-  if (root_->pendingIncomingInterestTable_)
+  // Encode once (or get the encoding from signing or receiving the packet) and
+  // send these bytes for every Interest that the Data packet satisfies.
+  Blob wireEncoding = data->wireEncode();
+  if (getRootState().pendingIncomingInterestTable_)
     // Quickly send the Data packet to satisfy interest, before calling callbacks.
-    root_->pendingIncomingInterestTable_->satisfyInterests(*data);
+    getRootState().pendingIncomingInterestTable_->satisfyInterests
+      (*data, wireEncoding);
+
+  attachData(data, wireEncoding, chrono::system_clock::now());
+  return true;
+}
+
+size_t
+Namespace::Impl::addData(const vector<ptr_lib::shared_ptr<Data>>& dataList)
+{
+  if (getIsShutDown())
+    return 0;
+
+  // Check all the names before attaching any Data packet.
+  for (size_t i = 0; i < dataList.size(); ++i) {
+    if (!isPrefixOfName(dataList[i]->getName()))
+      throw runtime_error
+        ("addData: The name of this node is not a prefix of the Data packet name");
+  }
+
+  chrono::system_clock::time_point now = chrono::system_clock::now();
+  vector<ptr_lib::shared_ptr<Data>> attachedData;
+  vector<Blob> wireEncodings;
+  attachedData.reserve(dataList.size());
+  wireEncodings.reserve(dataList.size());
+
+  // Defer the state change callbacks of created nodes.
+  beginBatch();
+  try {
+    for (size_t i = 0; i < dataList.size(); ++i) {
+      const ptr_lib::shared_ptr<Data>& data = dataList[i];
+      Namespace::Impl& dataImpl = getChildImpl(data->getName());
+      if (dataImpl.data_ && !dataImpl.isStale_)
+        // We already have an attached object. (A stale one can be replaced.)
+        continue;
+
+      wireEncodings.push_back(data->wireEncode());
+      attachedData.push_back(data);
+      dataImpl.attachData(data, wireEncodings.back(), now);
+    }
+
+    if (getRootState().pendingIncomingInterestTable_)
+      getRootState().pendingIncomingInterestTable_->satisfyInterests
+        (attachedData, wireEncodings);
+  } catch (...) {
+    commitBatch();
+    throw;
+  }
+  commitBatch();
 
+  return attachedData.size();
+}
+
+void
+Namespace::Impl::attachData
+  (const ptr_lib::shared_ptr<Data>& data, const Blob& wireEncoding,
+   chrono::system_clock::time_point nowTimePoint)
+{
   if (data->getMetaInfo().getFreshnessPeriod().count() >= 0.0)
     freshnessExpiryTime_ =
-      chrono::system_clock::now() +
+      nowTimePoint +
         chrono::duration_cast<chrono::milliseconds>(data->getMetaInfo().getFreshnessPeriod());
   else
     // Does not expire.
     freshnessExpiryTime_ = chrono::system_clock::time_point::min();
+  if (!data_)
+    updateNDataNodes(1);
   data_ = data;
-
-  return true;
+  dataWireEncoding_ = wireEncoding;
+  isStale_ = false;
+  updatePayload();
+  if (freshnessExpiryTime_ != chrono::system_clock::time_point::min())
+    scheduleFreshnessExpiry();
 }
 
 void
@@ -255,26 +459,49 @@ Namespace::Impl::getAllData
     dataList.push_back(data_);
 
   if (children_.size() > 0) {
-    for (map<Name::Component, ptr_lib::shared_ptr<Namespace>>::iterator i = children_.begin();
-         i != children_.end(); ++i)
-      i->second->impl_->getAllData(dataList);
+    const vector<Namespace::Impl*>& sortedChildren = getSortedChildren();
+    for (size_t i = 0; i < sortedChildren.size(); ++i)
+      sortedChildren[i]->getAllData(dataList);
   }
 }
 
 uint64_t
-Namespace::Impl::addOnStateChanged(const OnStateChanged& onStateChanged)
+Namespace::Impl::addOnStateChanged
+  (const OnStateChanged& onStateChanged, uint32_t stateMask, int relativeDepth)
 {
   uint64_t callbackId = getNextCallbackId();
-  onStateChangedCallbacks_[callbackId] = onStateChanged;
+  if (onStateChangedCallbacks_.empty())
+    invalidateNearestListeners();
+  onStateChangedCallbacks_.add
+    (callbackId, FilteredCallback<OnStateChanged>
+     (onStateChanged, stateMask, relativeDepth));
+  onStateChangedStateMask_ |= stateMask;
   return callbackId;
 }
 
 uint64_t
 Namespace::Impl::addOnValidateStateChanged
-  (const OnValidateStateChanged& onValidateStateChanged)
+  (const OnValidateStateChanged& onValidateStateChanged,
+   uint32_t validateStateMask, int relativeDepth)
+{
+  uint64_t callbackId = getNextCallbackId();
+  if (onValidateStateChangedCallbacks_.empty())
+    invalidateNearestListeners();
+  onValidateStateChangedCallbacks_.add
+    (callbackId, FilteredCallback<OnValidateStateChanged>
+     (onValidateStateChanged, validateStateMask, relativeDepth));
+  onValidateStateChangedStateMask_ |= validateStateMask;
+  return callbackId;
+}
+
+uint64_t
+Namespace::Impl::addOnStateChangedBatch
+  (const OnStateChangedBatch& onStateChangedBatch)
 {
   uint64_t callbackId = getNextCallbackId();
-  onValidateStateChangedCallbacks_[callbackId] = onValidateStateChanged;
+  if (onStateChangedBatchCallbacks_.empty())
+    invalidateNearestListeners();
+  onStateChangedBatchCallbacks_.add(callbackId, onStateChangedBatch);
   return callbackId;
 }
 
@@ -282,7 +509,9 @@ uint64_t
 Namespace::Impl::addOnObjectNeeded(const OnObjectNeeded& onObjectNeeded)
 {
   uint64_t callbackId = getNextCallbackId();
-  onObjectNeededCallbacks_[callbackId] = onObjectNeeded;
+  if (onObjectNeededCallbacks_.empty())
+    invalidateNearestListeners();
+  onObjectNeededCallbacks_.add(callbackId, onObjectNeeded);
   return callbackId;
 }
 
@@ -294,10 +523,12 @@ Namespace::Impl::setFace
   if (!face) {
     // Remove the Face if it is set.
     if (face_) {
-      face_->removeRegisteredPrefix(registeredPrefixId_);
+      if (registeredPrefixId_ != 0)
+        unregisterFace(face_, registeredPrefixId_);
       registeredPrefixId_ = 0;
-      // TODO: Remove the Face and callbacks from root_->fullPSync_.
+      // TODO: Remove the Face and callbacks from the root's fullPSync_.
       face_ = 0;
+      invalidateInheritedSettings();
     }
 
     return;
@@ -307,19 +538,16 @@ Namespace::Impl::setFace
     return;
 
   face_ = face;
+  invalidateInheritedSettings();
 
   if (onRegisterFailed) {
-    if (!root_->pendingIncomingInterestTable_)
-      // All onInterest callbacks share this in the root node. When we add a new
-      // Data packet to a Namespace node, we will also check if it satisfies a
-      // pending Interest.
-      root_->pendingIncomingInterestTable_ =
-        ptr_lib::make_shared<PendingIncomingInterestTable>();
+    createPendingIncomingInterestTable();
 
     registeredPrefixId_ = face->registerPrefix
-      (name_,
+      (getName(),
        bind(&Namespace::Impl::onInterest, shared_from_this(), _1, _2, _3, _4, _5),
        onRegisterFailed, onRegisterSuccess);
+    getRootState().pendingIncomingInterestTable_->addFace(face);
   }
 }
 
@@ -329,12 +557,12 @@ Namespace::Impl::enableSync(int depth)
   if (getIsShutDown())
     return;
 
-  if (!root_->fullPSync_) {
+  if (!getRootState().fullPSync_) {
     Face* face = getFace_();
     if (!face)
       throw runtime_error("enableSync: You must first call setFace on this or a parent");
 
-    root_->fullPSync_ = ptr_lib::make_shared<FullPSync2017>
+    getRootState().fullPSync_ = ptr_lib::make_shared<FullPSync2017>
       (275, *face, Name("/CNL-sync"),
        bind(&Namespace::Impl::onNamesUpdate, shared_from_this(), _1),
        *getKeyChain_(),
@@ -342,6 +570,7 @@ Namespace::Impl::enableSync(int depth)
   }
 
   syncDepth_ = depth;
+  invalidateInheritedSettings();
   // Debug: Add existing leaf nodes.
 }
 
@@ -351,27 +580,27 @@ Namespace::Impl::objectNeeded(bool mustBeFresh)
   if (getIsShutDown())
     return;
 
+  RootState& rootState = getRootState();
   // Check if we already have the object.
-  Interest interest(name_);
-  // TODO: Make the lifetime configurable.
-  interest.setInterestLifetimeMilliseconds(4000.0);
+  Interest interest(buildName());
   interest.setMustBeFresh(mustBeFresh);
   // Debug: This requires a Data packet. Check for an object without one?
-  Namespace::Impl* bestMatch = findBestMatchName
-    (*this, interest, chrono::system_clock::now());
+  root_->expireFreshness(chrono::system_clock::now());
+  Namespace::Impl* bestMatch = findBestMatchName(*this, interest);
   if (bestMatch && bestMatch->object_) {
+    bestMatch->touchPayload();
     // Set the state again to fire the callbacks.
-    bestMatch->setState(NamespaceState_OBJECT_READY);
+    bestMatch->setState(bestMatch->isStale_ ?
+      NamespaceState_OBJECT_READY_BUT_STALE : NamespaceState_OBJECT_READY);
     return;
   }
 
   // Ask all OnObjectNeeded callbacks if they can produce.
   bool canProduce = false;
-  Namespace::Impl* impl = this;
-  while (impl) {
+  for (Namespace::Impl* impl = getNearestListener(LISTENER_OBJECT_NEEDED);
+       impl; impl = impl->getNextListener(LISTENER_OBJECT_NEEDED)) {
     if (impl->fireOnObjectNeeded(outerNamespace_))
       canProduce = true;
-    impl = impl->parent_;
   }
 
   // Debug: Check if the object has been set (even if onObjectNeeded returned false.)
@@ -386,23 +615,105 @@ Namespace::Impl::objectNeeded(bool mustBeFresh)
   Face* face = getFace_();
   if (!face)
     throw runtime_error("A Face object has not been set for this or a parent");
-  // TODO: What if the state is already INTEREST_EXPRESSED?
+  if (chrono::system_clock::now() < negativeCacheExpiryTime_) {
+    // The last Interest failed recently, so fail fast without expressing.
+    ++rootState.nNegativeCacheHits_;
+    face->callLater
+      (chrono::nanoseconds(0),
+       bind(&Namespace::Impl::replayNegativeCacheEntry, shared_from_this()));
+    return;
+  }
+  if (!rootState.outgoingInterestTable_)
+    rootState.outgoingInterestTable_ =
+      ptr_lib::make_shared<OutgoingInterestTable>();
+  bool inFlightMustBeFresh;
+  bool isInFlight =
+    rootState.outgoingInterestTable_->find(this, inFlightMustBeFresh);
+  if (!rootState.outgoingInterestTable_->add(this, mustBeFresh))
+    // An Interest in flight for this node will answer the request.
+    return;
+  interest.setInterestLifetime(getNewInterestLifetime());
+  // If an Interest without MustBeFresh is still in flight, Data may answer
+  // it, so treat this as a retransmission which doesn't measure the RTT. If
+  // this throws, it removes an entry which it added and the state is
+  // unchanged.
+  expressInterest(face, interest, isInFlight);
   setState(NamespaceState_INTEREST_EXPRESSED);
-  face->expressInterest
-    (interest,
-     bind(&Namespace::Impl::onData, shared_from_this(), _1, _2),
-     ExponentialReExpress::makeOnTimeout
-       (face, bind(&Namespace::Impl::onData, shared_from_this(), _1, _2),
-        bind(&Namespace::Impl::onTimeout, shared_from_this(), _1),
-        getMaxInterestLifetime()),
-     bind(&Namespace::Impl::onNetworkNack, shared_from_this(), _1, _2));
+}
+
+bool
+Namespace::Impl::reExpressInterest()
+{
+  if (getIsShutDown())
+    return false;
+
+  bool mustBeFresh;
+  if (!getRootState().outgoingInterestTable_ ||
+      !getRootState().outgoingInterestTable_->find(this, mustBeFresh))
+    return false;
+  Face* face = getFace_();
+  if (!face)
+    return false;
+
+  Interest interest(buildName());
+  interest.setMustBeFresh(mustBeFresh);
+  interest.setInterestLifetime(getNewInterestLifetime());
+  _LOG_DEBUG("Re-express interest: " << interest.getName());
+  expressInterest(face, interest, true);
+  return true;
 }
 
 void
 Namespace::Impl::removeCallback(uint64_t callbackId)
 {
-  onStateChangedCallbacks_.erase(callbackId);
-  onValidateStateChangedCallbacks_.erase(callbackId);
+  if (onStateChangedCallbacks_.remove(callbackId)) {
+    updateStateMasks();
+    if (onStateChangedCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  else if (onValidateStateChangedCallbacks_.remove(callbackId)) {
+    updateStateMasks();
+    if (onValidateStateChangedCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  else if (onStateChangedBatchCallbacks_.remove(callbackId)) {
+    if (onStateChangedBatchCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  else if (onObjectNeededCallbacks_.remove(callbackId)) {
+    if (onObjectNeededCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  else if (onDeserializeNeededCallbacks_.remove(callbackId)) {
+    if (onDeserializeNeededCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  else if (onIncomingInterestTimeoutCallbacks_.remove(callbackId)) {
+    if (onIncomingInterestTimeoutCallbacks_.empty())
+      invalidateNearestListeners();
+  }
+  // addOnEvicted and addOnInterestRetransmitted keep the callback in the root.
+  else if (!getRootState().onEvictedCallbacks_.remove(callbackId))
+    getRootState().onInterestRetransmittedCallbacks_.remove(callbackId);
+}
+
+void
+Namespace::Impl::updateStateMasks()
+{
+  onStateChangedStateMask_ = 0;
+  onStateChangedCallbacks_.dispatch
+    ([&](uint64_t callbackId, FilteredCallback<OnStateChanged>& callback) {
+      onStateChangedStateMask_ |= callback.getStateMask();
+      return false;
+    });
+
+  onValidateStateChangedStateMask_ = 0;
+  onValidateStateChangedCallbacks_.dispatch
+    ([&](uint64_t callbackId,
+         FilteredCallback<OnValidateStateChanged>& callback) {
+      onValidateStateChangedStateMask_ |= callback.getStateMask();
+      return false;
+    });
 }
 
 void
@@ -423,10 +734,14 @@ Namespace::Impl::getIsShutDown()
   if (*isShutDown_) {
     if (face_) {
       // We are shut down, so remove the Face and the callback.
-      face_->removeRegisteredPrefix(registeredPrefixId_);
+      if (registeredPrefixId_ != 0)
+        unregisterFace(face_, registeredPrefixId_);
       registeredPrefixId_ = 0;
       face_ = 0;
+      invalidateInheritedSettings();
     }
+    if (addedFaces_.size() > 0)
+      removeAddedFaces();
 
     return true;
   }
@@ -441,14 +756,8 @@ Namespace::Impl::getFace_()
     throw runtime_error
       ("Cannot get the Face of this Namespace node because it is shut down");
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->face_)
-      return impl->face_;
-    impl = impl->parent_;
-  }
-
-  return 0;
+  updateInheritedSettings();
+  return inheritedFace_;
 }
 
 KeyChain*
@@ -458,14 +767,8 @@ Namespace::Impl::getKeyChain_()
     throw runtime_error
       ("Cannot get the KeyChain of this Namespace node because it is shut down");
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->keyChain_)
-      return impl->keyChain_;
-    impl = impl->parent_;
-  }
-
-  return 0;
+  updateInheritedSettings();
+  return inheritedKeyChain_;
 }
 
 Namespace::Impl*
@@ -475,14 +778,8 @@ Namespace::Impl::getSyncNode()
     throw runtime_error
       ("Cannot get the Sync Node of this Namespace node because it is shut down");
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->syncDepth_ >= 0)
-      return impl;
-    impl = impl->parent_;
-  }
-
-  return 0;
+  updateInheritedSettings();
+  return inheritedSyncNode_;
 }
 
 std::chrono::nanoseconds
@@ -492,206 +789,1078 @@ Namespace::Impl::getMaxInterestLifetime()
     throw runtime_error
       ("Cannot get the MaxInterestLifetime of this Namespace node because it is shut down");
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->maxInterestLifetime_.count() >= 0)
-      return impl->maxInterestLifetime_;
-    impl =impl->parent_;
-  }
+  updateInheritedSettings();
+  if (inheritedMaxInterestLifetime_.count() < 0)
+    // Use the default of ExponentialReExpress.
+    return chrono::seconds(16);
+  return inheritedMaxInterestLifetime_;
+}
 
-  // Return the default.
-  return std::chrono::nanoseconds(-1);
+std::chrono::nanoseconds
+Namespace::Impl::getNegativeCacheTtl()
+{
+  updateInheritedSettings();
+  return inheritedNegativeCacheTtl_;
 }
 
-const MetaInfo*
-Namespace::Impl::getNewDataMetaInfo_()
+void
+Namespace::Impl::addNegativeCacheEntry(const NetworkNack* networkNack)
 {
-  if (getIsShutDown())
-    throw runtime_error
-      ("Cannot get the NewDataMetaInfo of this Namespace node because it is shut down");
+  chrono::nanoseconds ttl = getNegativeCacheTtl();
+  if (ttl.count() < 0)
+    return;
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->newDataMetaInfo_)
-      return impl->newDataMetaInfo_.get();
-    impl = impl->parent_;
+  NamespaceState state = NamespaceState_INTEREST_TIMEOUT;
+  if (networkNack) {
+    state = NamespaceState_INTEREST_NETWORK_NACK;
+    int reason = networkNack->getReason();
+    if (reason == ndn_NetworkNackReason_DUPLICATE)
+      // The Interest looped, which says nothing about the producer.
+      return;
+    else if (reason == ndn_NetworkNackReason_NO_ROUTE)
+      // Routes don't appear quickly, so wait longer.
+      ttl *= 4;
+    else if (reason == ndn_NetworkNackReason_CONGESTION)
+      // Congestion is transient, so retry sooner.
+      ttl /= 2;
   }
 
-  return 0;
+  // Double the time to live for each consecutive failure, up to 64 times.
+  ++nNegativeCacheFailures_;
+  ttl *= 1 << min(nNegativeCacheFailures_ - 1, 6);
+
+  negativeCacheState_ = state;
+  negativeCacheExpiryTime_ = chrono::system_clock::now() +
+    chrono::duration_cast<chrono::system_clock::duration>(ttl);
 }
 
-DecryptorV2*
-Namespace::Impl::getDecryptor()
+void
+Namespace::Impl::replayNegativeCacheEntry()
 {
-  if (getIsShutDown())
-    throw runtime_error
-      ("Cannot get the Decryptor of this Namespace node because it is shut down");
+  if (getIsShutDown() || isDeleted_)
+    // If the node was removed from the tree, the root may be deleted.
+    return;
+  if (negativeCacheExpiryTime_ == chrono::system_clock::time_point::min())
+    // A Data packet arrived in the meantime.
+    return;
 
-  Namespace::Impl* impl =this;
-  while (impl) {
-    if (impl->decryptor_)
-      return impl->decryptor_;
-    impl = impl->parent_;
+  setState(negativeCacheState_);
+}
+
+void
+Namespace::Impl::resolveInheritedSettings()
+{
+  if (parent_) {
+    parent_->updateInheritedSettings();
+
+    inheritedFace_ = face_ ? face_ : parent_->inheritedFace_;
+    inheritedKeyChain_ = keyChain_ ? keyChain_ : parent_->inheritedKeyChain_;
+    inheritedDecryptor_ =
+      decryptor_ ? decryptor_ : parent_->inheritedDecryptor_;
+    inheritedNewDataMetaInfo_ = newDataMetaInfo_ ?
+      newDataMetaInfo_.get() : parent_->inheritedNewDataMetaInfo_;
+    inheritedMaxInterestLifetime_ = maxInterestLifetime_.count() >= 0 ?
+      maxInterestLifetime_ : parent_->inheritedMaxInterestLifetime_;
+    inheritedNegativeCacheTtl_ = negativeCacheTtl_.count() >= 0 ?
+      negativeCacheTtl_ : parent_->inheritedNegativeCacheTtl_;
+    inheritedSyncNode_ = syncDepth_ >= 0 ? this : parent_->inheritedSyncNode_;
+  }
+  else {
+    inheritedFace_ = face_;
+    inheritedKeyChain_ = keyChain_;
+    inheritedDecryptor_ = decryptor_;
+    inheritedNewDataMetaInfo_ = newDataMetaInfo_.get();
+    // If not specified, this is -1 which is the default.
+    inheritedMaxInterestLifetime_ = maxInterestLifetime_;
+    inheritedNegativeCacheTtl_ = negativeCacheTtl_;
+    inheritedSyncNode_ = syncDepth_ >= 0 ? this : 0;
   }
 
-  return 0;
+  inheritedSettingsEpoch_ = getRootState().settingsEpoch_;
 }
 
-uint64_t
-Namespace::Impl::addOnDeserializeNeeded_
-  (const Handler::OnDeserializeNeeded& onDeserializeNeeded)
+size_t
+Namespace::Impl::getNPendingIncomingInterests()
 {
-  uint64_t callbackId = getNextCallbackId();
-  onDeserializeNeededCallbacks_[callbackId] = onDeserializeNeeded;
-  return callbackId;
+  return getRootState().pendingIncomingInterestTable_ ?
+    getRootState().pendingIncomingInterestTable_->size() : 0;
+}
+
+size_t
+Namespace::Impl::getPendingIncomingInterestsHighWaterMark()
+{
+  return getRootState().pendingIncomingInterestTable_ ?
+    getRootState().pendingIncomingInterestTable_->getHighWaterMark() : 0;
 }
 
 void
-Namespace::Impl::deserialize_
-  (const Blob& blob, const Handler::OnObjectSet& onObjectSet)
+Namespace::Impl::addFace
+  (Face* face, const OnRegisterFailed& onRegisterFailed,
+   const OnRegisterSuccess& onRegisterSuccess)
 {
   if (getIsShutDown())
     return;
 
-  Namespace::Impl* impl = this;
-  while (impl) {
-    if (impl->fireOnDeserializeNeeded(*this, blob, onObjectSet)) {
-      // Wait for the Handler to set the object, if it hasn't yet.
-      if (state_ < NamespaceState_DESERIALIZING)
-        setState(NamespaceState_DESERIALIZING);
+  for (size_t i = 0; i < addedFaces_.size(); ++i) {
+    if (addedFaces_[i].first == face)
+      throw runtime_error("addFace: The Face was already added to this node");
+  }
+
+  createPendingIncomingInterestTable();
+
+  uint64_t registeredPrefixId = face->registerPrefix
+    (getName(),
+     bind(&Namespace::Impl::onInterest, shared_from_this(), _1, _2, _3, _4, _5),
+     onRegisterFailed, onRegisterSuccess);
+  addedFaces_.push_back(make_pair(face, registeredPrefixId));
+  getRootState().pendingIncomingInterestTable_->addFace(face);
+}
+
+void
+Namespace::Impl::removeFace(Face* face)
+{
+  for (size_t i = 0; i < addedFaces_.size(); ++i) {
+    if (addedFaces_[i].first == face) {
+      uint64_t registeredPrefixId = addedFaces_[i].second;
+      addedFaces_.erase(addedFaces_.begin() + i);
+      unregisterFace(face, registeredPrefixId);
       return;
     }
-
-    impl = impl->parent_;
   }
+}
 
-  // Debug: Check if the object has been set (even if canDeserialize returned false.)
+void
+Namespace::Impl::removeAddedFaces()
+{
+  vector<pair<Face*, uint64_t>> addedFaces;
+  addedFaces.swap(addedFaces_);
+  for (size_t i = 0; i < addedFaces.size(); ++i)
+    unregisterFace(addedFaces[i].first, addedFaces[i].second);
+}
 
-  // Just call defaultOnDeserialized immediately.
-  defaultOnDeserialized(ptr_lib::make_shared<BlobObject>(blob), onObjectSet);
+void
+Namespace::Impl::unregisterFace(Face* face, uint64_t registeredPrefixId)
+{
+  face->removeRegisteredPrefix(registeredPrefixId);
+  if (getRootState().pendingIncomingInterestTable_)
+    // The pending Interests refer to the face, so remove them with it.
+    getRootState().pendingIncomingInterestTable_->removeFace(face);
 }
 
-Namespace&
-Namespace::Impl::createChild(const Name::Component& component, bool fireCallbacks)
+Namespace::FaceCounters
+Namespace::Impl::getFaceCounters(const Face* face)
 {
-  if (getIsShutDown())
-    throw runtime_error
-      ("Cannot create a child of this Namespace node because it is shut down");
+  const FaceCounters* counters = 0;
+  if (getRootState().pendingIncomingInterestTable_)
+    counters =
+      getRootState().pendingIncomingInterestTable_->findFaceCounters(face);
 
-  // Every child has a shared_ptr to the same isShutDown_ flag.
-  ptr_lib::shared_ptr<Namespace> child(new Namespace
-    (Name(name_).append(component), (KeyChain *)0, isShutDown_));
-  child->impl_->parent_ = this;
-  child->impl_->root_ = root_;
-  children_[component] = child;
+  return counters ? *counters : FaceCounters();
+}
 
-  if (fireCallbacks) {
-    child->impl_->setState(NamespaceState_NAME_EXISTS);
+size_t
+Namespace::Impl::getNInFlightInterests()
+{
+  return getRootState().outgoingInterestTable_ ?
+    getRootState().outgoingInterestTable_->size() : 0;
+}
+
+uint64_t
+Namespace::Impl::getNCoalescedInterests()
+{
+  return getRootState().outgoingInterestTable_ ?
+    getRootState().outgoingInterestTable_->getNCoalescedInterests() : 0;
+}
 
-    // Sync this name under the same conditions that we report a NAME_EXISTS.
-    if (root_->fullPSync_) {
-      Namespace::Impl* syncNode = child->impl_->getSyncNode();
-      if (syncNode) {
-        // Only sync names to the specified depth.
-        int depth = child->impl_->name_.size() - syncNode->name_.size();
+chrono::nanoseconds
+Namespace::Impl::getSmoothedRtt() { return getRttEstimator().getSmoothedRtt(); }
 
-        if (depth <= syncNode->syncDepth_)
-          // If createChild is called when onNamesUpdate receives a name from
-          //   fullPSync_, then publishName already has it and will ignore it.
-          root_->fullPSync_->publishName(child->impl_->name_);
-      }
-    }
-  }
+chrono::nanoseconds
+Namespace::Impl::getRttVariation() { return getRttEstimator().getRttVariation(); }
 
-  return *child;
+chrono::nanoseconds
+Namespace::Impl::getRetransmissionTimeout()
+{
+  return getRttEstimator().getRto();
 }
 
 void
-Namespace::Impl::setState(NamespaceState state)
+Namespace::Impl::removeOutgoingInterest()
 {
-  if (getIsShutDown())
-    return;
+  if (getRootState().outgoingInterestTable_)
+    getRootState().outgoingInterestTable_->remove(this);
+}
 
-  state_ = state;
+void
+Namespace::Impl::setMaxPendingIncomingInterests
+  (size_t maxPendingIncomingInterests,
+   IncomingInterestOverloadPolicy overloadPolicy)
+{
+  RootState& rootState = getRootState();
+  rootState.maxPendingIncomingInterests_ = maxPendingIncomingInterests;
+  rootState.incomingInterestOverloadPolicy_ = overloadPolicy;
+  if (rootState.pendingIncomingInterestTable_)
+    rootState.pendingIncomingInterestTable_->setMaxEntries
+      (maxPendingIncomingInterests, overloadPolicy);
+}
 
-  // Fire callbacks.
-  Namespace::Impl* impl = this;
-  while (impl) {
-    impl->fireOnStateChanged(outerNamespace_, state);
-    impl = impl->parent_;
-  }
+uint64_t
+Namespace::Impl::addOnIncomingInterestTimeout
+  (const OnIncomingInterestTimeout& onIncomingInterestTimeout)
+{
+  uint64_t callbackId = getNextCallbackId();
+  if (onIncomingInterestTimeoutCallbacks_.empty())
+    invalidateNearestListeners();
+  onIncomingInterestTimeoutCallbacks_.add(callbackId, onIncomingInterestTimeout);
+  return callbackId;
 }
 
 void
-Namespace::Impl::fireOnStateChanged
-  (Namespace& changedNamespace, NamespaceState state)
+Namespace::Impl::createPendingIncomingInterestTable()
 {
-  if (getIsShutDown())
+  RootState& rootState = getRootState();
+  if (rootState.pendingIncomingInterestTable_)
     return;
 
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onStateChangedCallbacks_.size());
-  for (map<uint64_t, OnStateChanged>::iterator i = onStateChangedCallbacks_.begin();
-       i != onStateChangedCallbacks_.end(); ++i)
-    keys.push_back(i->first);
-
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, OnStateChanged>::iterator entry =
-      onStateChangedCallbacks_.find(keys[i]);
-    if (entry != onStateChangedCallbacks_.end()) {
-      try {
-        entry->second(outerNamespace_, changedNamespace, state, entry->first);
-      } catch (const std::exception& ex) {
-        _LOG_ERROR("Namespace::fireOnStateChanged: Error in onStateChanged: " <<
-                   ex.what());
-      } catch (...) {
-        _LOG_ERROR("Namespace::fireOnStateChanged: Error in onStateChanged.");
-      }
-    }
-  }
+  // All onInterest callbacks share this in the root node. When we add a new
+  // Data packet to a Namespace node, we will also check if it satisfies a
+  // pending Interest. The root owns the table, so the callback can use a
+  // plain pointer to it.
+  rootState.pendingIncomingInterestTable_ =
+    ptr_lib::make_shared<PendingIncomingInterestTable>
+      (bind(&Namespace::Impl::onIncomingInterestUnsatisfied, root_, _1));
+  rootState.pendingIncomingInterestTable_->setMaxEntries
+    (rootState.maxPendingIncomingInterests_,
+     rootState.incomingInterestOverloadPolicy_);
 }
 
 void
-Namespace::Impl::setValidateState(NamespaceValidateState validateState)
+Namespace::Impl::onIncomingInterestUnsatisfied
+  (const ptr_lib::shared_ptr<const Interest>& interest)
 {
   if (getIsShutDown())
     return;
 
-  validateState_ = validateState;
+  Name interestName = interest->getName();
+  if (interestName.size() >= 1 && interestName[-1].isImplicitSha256Digest())
+    // Strip the implicit digest.
+    interestName = interestName.getPrefix(-1);
+  if (!isPrefixOfName(interestName))
+    return;
+
+  // Don't create nodes for the Interest name.
+  Namespace::Impl* interestNamespaceImpl = findDeepestImpl(interestName);
+  // Hold the node in case a callback removes it.
+  ptr_lib::shared_ptr<Namespace::Impl> interestNamespaceImplHolder =
+    interestNamespaceImpl->shared_from_this();
+  if (interestNamespaceImpl->depth_ == interestName.size())
+    // If onInterest created a speculative node for the Interest and a producer
+    // didn't produce it, then it is no longer needed for the Interest.
+    interestNamespaceImpl->clearSpeculative();
+  for (Namespace::Impl* impl = interestNamespaceImpl->getNearestListener
+         (LISTENER_INCOMING_INTEREST_TIMEOUT);
+       impl; impl = impl->getNextListener(LISTENER_INCOMING_INTEREST_TIMEOUT))
+    impl->fireOnIncomingInterestTimeout
+      (interestNamespaceImpl->outerNamespace_, interest);
+}
+
+void
+Namespace::Impl::fireOnIncomingInterestTimeout
+  (Namespace& interestNamespace, const ptr_lib::shared_ptr<const Interest>& interest)
+{
+  // The registry skips callbacks which are removed by a callback.
+  onIncomingInterestTimeoutCallbacks_.dispatch
+    ([&](uint64_t callbackId,
+         OnIncomingInterestTimeout& onIncomingInterestTimeout) {
+      try {
+        onIncomingInterestTimeout
+          (outerNamespace_, interestNamespace, interest, callbackId);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR
+          ("Namespace::fireOnIncomingInterestTimeout: Error in onIncomingInterestTimeout: " <<
+           ex.what());
+      } catch (...) {
+        _LOG_ERROR
+          ("Namespace::fireOnIncomingInterestTimeout: Error in onIncomingInterestTimeout.");
+      }
+      return false;
+    });
+}
+
+bool
+Namespace::Impl::hasListeners(ListenerKind kind) const
+{
+  switch (kind) {
+  case LISTENER_STATE_CHANGED:
+    return !onStateChangedCallbacks_.empty();
+  case LISTENER_VALIDATE_STATE_CHANGED:
+    return !onValidateStateChangedCallbacks_.empty();
+  case LISTENER_STATE_CHANGED_BATCH:
+    return !onStateChangedBatchCallbacks_.empty();
+  case LISTENER_OBJECT_NEEDED:
+    return !onObjectNeededCallbacks_.empty();
+  case LISTENER_DESERIALIZE_NEEDED:
+    return !onDeserializeNeededCallbacks_.empty();
+  case LISTENER_INCOMING_INTEREST_TIMEOUT:
+    return !onIncomingInterestTimeoutCallbacks_.empty();
+  default:
+    return false;
+  }
+}
+
+void
+Namespace::Impl::resolveNearestListeners()
+{
+  if (parent_) {
+    // Make sure the parent's nearest listeners are resolved.
+    parent_->getNearestListener(LISTENER_STATE_CHANGED);
+
+    for (int kind = 0; kind < N_LISTENER_KINDS; ++kind)
+      nearestListener_[kind] = hasListeners((ListenerKind)kind) ?
+        this : parent_->nearestListener_[kind];
+  }
+  else {
+    for (int kind = 0; kind < N_LISTENER_KINDS; ++kind)
+      nearestListener_[kind] = hasListeners((ListenerKind)kind) ? this : 0;
+  }
+
+  nearestListenersEpoch_ = getRootState().listenersEpoch_;
+}
+
+size_t
+Namespace::Impl::getNNodes()
+{
+  const RootState& rootState = getRootState();
+  return rootState.nodePool_ ? rootState.nodePool_->getNNodes() : 0;
+}
+
+size_t
+Namespace::Impl::getNodeStorageBytes()
+{
+  const RootState& rootState = getRootState();
+  return rootState.nodePool_ ? rootState.nodePool_->getNBytesInUse() : 0;
+}
+
+size_t
+Namespace::Impl::getNNodeStorageAllocations()
+{
+  const RootState& rootState = getRootState();
+  return rootState.nodePool_ ?
+    rootState.nodePool_->getNSystemAllocations() : 0;
+}
+
+const MetaInfo*
+Namespace::Impl::getNewDataMetaInfo_()
+{
+  if (getIsShutDown())
+    throw runtime_error
+      ("Cannot get the NewDataMetaInfo of this Namespace node because it is shut down");
+
+  updateInheritedSettings();
+  return inheritedNewDataMetaInfo_;
+}
+
+DecryptorV2*
+Namespace::Impl::getDecryptor()
+{
+  if (getIsShutDown())
+    throw runtime_error
+      ("Cannot get the Decryptor of this Namespace node because it is shut down");
+
+  updateInheritedSettings();
+  return inheritedDecryptor_;
+}
+
+uint64_t
+Namespace::Impl::addOnEvicted(const OnEvicted& onEvicted)
+{
+  uint64_t callbackId = getNextCallbackId();
+  getRootState().onEvictedCallbacks_.add(callbackId, onEvicted);
+  return callbackId;
+}
+
+uint64_t
+Namespace::Impl::addOnInterestRetransmitted
+  (const OnInterestRetransmitted& onInterestRetransmitted)
+{
+  uint64_t callbackId = getNextCallbackId();
+  getRootState().onInterestRetransmittedCallbacks_.add
+    (callbackId, onInterestRetransmitted);
+  return callbackId;
+}
+
+void
+Namespace::Impl::updateNDataNodes(int delta)
+{
+  Namespace::Impl* impl = this;
+  while (impl) {
+    impl->nDataNodes_ += delta;
+    if (impl->nDataNodes_ == 0)
+      impl->maxDataDepth_ = 0;
+    else if (delta > 0 && impl->maxDataDepth_ < depth_)
+      impl->maxDataDepth_ = depth_;
 
-  // Fire callbacks.
-  Namespace::Impl* impl = this;
-  while (impl) {
-    impl->fireOnValidateStateChanged(outerNamespace_, validateState);
     impl = impl->parent_;
   }
 }
 
+void
+Namespace::Impl::updatePayload()
+{
+  unlinkPayload();
+
+  RootState& rootState = getRootState();
+  payloadBytes_ = 0;
+  if (data_)
+    payloadBytes_ += dataWireEncoding_.size();
+  if (object_) {
+    BlobObject* blobObject = dynamic_cast<BlobObject*>(object_.get());
+    // Don't count a Blob twice if the object shares the Data content.
+    if (blobObject &&
+        !(data_ && blobObject->buf() == data_->getContent().buf()))
+      payloadBytes_ += blobObject->size();
+  }
+
+  if (data_ || object_) {
+    // The node has been produced, so it is no longer speculative.
+    clearSpeculative();
+
+    // Link as the most recently used.
+    olderPayload_ = rootState.newestPayload_;
+    newerPayload_ = 0;
+    if (rootState.newestPayload_)
+      rootState.newestPayload_->newerPayload_ = this;
+    else
+      rootState.oldestPayload_ = this;
+    rootState.newestPayload_ = this;
+    isInPayloadList_ = true;
+    rootState.totalPayloadBytes_ += payloadBytes_;
+  }
+
+  root_->evictPayloads(this);
+}
+
+void
+Namespace::Impl::touchPayload()
+{
+  if (!isInPayloadList_)
+    return;
+  RootState& rootState = getRootState();
+  if (rootState.newestPayload_ == this)
+    return;
+
+  // Unlink without changing the total, then link as the most recently used.
+  if (olderPayload_)
+    olderPayload_->newerPayload_ = newerPayload_;
+  else
+    rootState.oldestPayload_ = newerPayload_;
+  // We know this is not the newest, so newerPayload_ is not null.
+  newerPayload_->olderPayload_ = olderPayload_;
+
+  olderPayload_ = rootState.newestPayload_;
+  newerPayload_ = 0;
+  rootState.newestPayload_->newerPayload_ = this;
+  rootState.newestPayload_ = this;
+}
+
+void
+Namespace::Impl::unlinkPayload()
+{
+  if (!isInPayloadList_)
+    return;
+
+  RootState& rootState = getRootState();
+  if (olderPayload_)
+    olderPayload_->newerPayload_ = newerPayload_;
+  else
+    rootState.oldestPayload_ = newerPayload_;
+  if (newerPayload_)
+    newerPayload_->olderPayload_ = olderPayload_;
+  else
+    rootState.newestPayload_ = olderPayload_;
+
+  olderPayload_ = 0;
+  newerPayload_ = 0;
+  isInPayloadList_ = false;
+  rootState.totalPayloadBytes_ -= payloadBytes_;
+}
+
+void
+Namespace::Impl::evictPayloads(Namespace::Impl* keepNode)
+{
+  RootState& rootState = *rootState_;
+  if (rootState.maxPayloadBytes_ == 0 ||
+      rootState.totalPayloadBytes_ <= rootState.maxPayloadBytes_ ||
+      rootState.isEvicting_)
+    return;
+
+  // First evict from the least recently used, then call the callbacks which
+  // may change the payload list.
+  vector<pair<ptr_lib::shared_ptr<Namespace::Impl>, size_t>> evicted;
+  Namespace::Impl* impl = rootState.oldestPayload_;
+  while (impl && rootState.totalPayloadBytes_ > rootState.maxPayloadBytes_) {
+    Namespace::Impl* newer = impl->newerPayload_;
+
+    if (impl != keepNode && !impl->isPayloadInFlight()) {
+      evicted.push_back(make_pair(impl->shared_from_this(), impl->payloadBytes_));
+      rootState.nEvictedPayloadBytes_ += impl->payloadBytes_;
+      impl->clearPayload();
+    }
+
+    impl = newer;
+  }
+
+  // fireOnEvicted logs exceptions, so this doesn't need try/catch. While
+  // isEvicting_, a callback which sets a payload doesn't evict recursively.
+  rootState.isEvicting_ = true;
+  for (size_t i = 0; i < evicted.size(); ++i)
+    fireOnEvicted(evicted[i].first->outerNamespace_, evicted[i].second);
+
+  if (rootState.removeEmptyNodes_) {
+    for (size_t i = 0; i < evicted.size(); ++i)
+      evicted[i].first->removeIfEmpty(0);
+  }
+  rootState.isEvicting_ = false;
+}
+
+void
+Namespace::Impl::clearPayload()
+{
+  unlinkPayload();
+  payloadBytes_ = 0;
+  if (data_)
+    updateNDataNodes(-1);
+  data_.reset();
+  dataWireEncoding_ = Blob();
+  object_.reset();
+  freshnessExpiryTime_ = chrono::system_clock::time_point::min();
+  isStale_ = false;
+  // Don't fire OnStateChanged since the object was already reported.
+  state_ = NamespaceState_NAME_EXISTS;
+  validateState_ = NamespaceValidateState_WAITING_FOR_DATA;
+}
+
+void
+Namespace::Impl::releasePayload()
+{
+  if (getIsShutDown() || isPayloadInFlight())
+    return;
+
+  clearPayload();
+}
+
+void
+Namespace::Impl::releasePayloadLater()
+{
+  if (getIsShutDown())
+    return;
+  Face* face = getFace_();
+  if (!face)
+    return;
+
+  face->callLater
+    (chrono::nanoseconds(0),
+     bind(&Namespace::Impl::releaseAndRemovePayload, shared_from_this()));
+}
+
+bool
+Namespace::Impl::isPayloadInFlight() const
+{
+  return state_ == NamespaceState_INTEREST_EXPRESSED ||
+         state_ == NamespaceState_DESERIALIZING ||
+         state_ == NamespaceState_DECRYPTING ||
+         state_ == NamespaceState_PRODUCING_OBJECT ||
+         state_ == NamespaceState_SERIALIZING ||
+         state_ == NamespaceState_ENCRYPTING ||
+         state_ == NamespaceState_SIGNING;
+}
+
+void
+Namespace::Impl::removeIfEmpty(Namespace::Impl* stopNode)
+{
+  Namespace::Impl* impl = this;
+  while (impl != stopNode && impl->parent_ && !impl->isInPayloadList_ && !impl->data_ &&
+         !impl->object_ && impl->children_.size() == 0 &&
+         !impl->isPayloadInFlight() &&
+         impl->onStateChangedCallbacks_.empty() &&
+         impl->onValidateStateChangedCallbacks_.empty() &&
+         impl->onObjectNeededCallbacks_.empty() &&
+         impl->onDeserializeNeededCallbacks_.empty() &&
+         impl->onStateChangedBatchCallbacks_.empty() &&
+         impl->onIncomingInterestTimeoutCallbacks_.empty() &&
+         !impl->face_ && !impl->keyChain_ && !impl->decryptor_ &&
+         !impl->newDataMetaInfo_ && impl->maxInterestLifetime_.count() < 0 &&
+         impl->negativeCacheTtl_.count() < 0 && impl->syncDepth_ < 0) {
+    Namespace::Impl* parent = impl->parent_;
+
+    ChildMap::iterator child = parent->children_.find(impl->component_);
+    if (child == parent->children_.end() || child->second->impl_.get() != impl)
+      // A callback already removed it.
+      return;
+
+    if (parent->isSortedChildrenValid_) {
+      vector<Namespace::Impl*>::iterator sortedChild = lower_bound
+        (parent->sortedChildren_.begin(), parent->sortedChildren_.end(), impl,
+         [](Namespace::Impl* a, Namespace::Impl* b) {
+           return a->component_.compare(b->component_) < 0;
+         });
+      if (sortedChild != parent->sortedChildren_.end() && *sortedChild == impl)
+        parent->sortedChildren_.erase(sortedChild);
+    }
+    // This may delete impl.
+    parent->children_.erase(child);
+
+    impl = parent;
+  }
+}
+
+void
+Namespace::Impl::releaseAndRemovePayload()
+{
+  if (getIsShutDown() || isDeleted_)
+    return;
+
+  releasePayload();
+  if (parent_)
+    // Only remove this node, since the parent may be used by a handler.
+    removeIfEmpty(parent_);
+}
+
+void
+Namespace::Impl::fireOnEvicted(Namespace& evictedNamespace, size_t nBytes)
+{
+  RootState& rootState = *rootState_;
+  if (getIsShutDown())
+    return;
+
+  // The registry skips callbacks which are removed by a callback.
+  rootState.onEvictedCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnEvicted& onEvicted) {
+      try {
+        onEvicted(outerNamespace_, evictedNamespace, nBytes, callbackId);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR("Namespace::fireOnEvicted: Error in onEvicted: " << ex.what());
+      } catch (...) {
+        _LOG_ERROR("Namespace::fireOnEvicted: Error in onEvicted.");
+      }
+      return false;
+    });
+}
+
+void
+Namespace::Impl::fireOnInterestRetransmitted(Namespace& retransmittedNamespace)
+{
+  RootState& rootState = *rootState_;
+  if (getIsShutDown())
+    return;
+
+  // The registry skips callbacks which are removed by a callback.
+  rootState.onInterestRetransmittedCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnInterestRetransmitted& onInterestRetransmitted) {
+      try {
+        onInterestRetransmitted(outerNamespace_, retransmittedNamespace, callbackId);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR("Namespace::fireOnInterestRetransmitted: Error in onInterestRetransmitted: " <<
+                   ex.what());
+      } catch (...) {
+        _LOG_ERROR("Namespace::fireOnInterestRetransmitted: Error in onInterestRetransmitted.");
+      }
+      return false;
+    });
+}
+
+void
+Namespace::Impl::scheduleFreshnessExpiry()
+{
+  RootState& rootState = getRootState();
+  rootState.freshnessExpiryQueue_.push
+    (FreshnessExpiry(freshnessExpiryTime_, shared_from_this()));
+
+  if (freshnessExpiryTime_ >= rootState.freshnessTimerTime_)
+    // The pending timer will fire first and schedule the next one.
+    return;
+
+  Face* face = getFace_();
+  if (!face)
+    // onInterest and objectNeeded still call expireFreshness.
+    return;
+
+  chrono::nanoseconds delay = chrono::duration_cast<chrono::nanoseconds>
+    (freshnessExpiryTime_ - chrono::system_clock::now());
+  if (delay.count() < 0)
+    delay = chrono::nanoseconds(0);
+  rootState.freshnessTimerTime_ = freshnessExpiryTime_;
+  face->callLater
+    (delay, bind(&Namespace::Impl::onFreshnessTimer, root_->shared_from_this()));
+}
+
+void
+Namespace::Impl::expireFreshness(chrono::system_clock::time_point nowTimePoint)
+{
+  RootState& rootState = *rootState_;
+  if (getIsShutDown())
+    return;
+
+  while (!rootState.freshnessExpiryQueue_.empty() &&
+         rootState.freshnessExpiryQueue_.top().getExpiryTime() <=
+           nowTimePoint) {
+    chrono::system_clock::time_point expiryTime =
+      rootState.freshnessExpiryQueue_.top().getExpiryTime();
+    ptr_lib::shared_ptr<Namespace::Impl> impl =
+      rootState.freshnessExpiryQueue_.top().getImpl().lock();
+    // Pop before calling callbacks which may call this again.
+    rootState.freshnessExpiryQueue_.pop();
+
+    if (!impl || !impl->data_ || impl->isStale_ ||
+        impl->freshnessExpiryTime_ != expiryTime)
+      // The node was removed, or its Data packet was evicted or replaced.
+      continue;
+
+    impl->isStale_ = true;
+    if (impl->state_ == NamespaceState_OBJECT_READY)
+      impl->setState(NamespaceState_OBJECT_READY_BUT_STALE);
+
+    if (rootState.refetchStaleObjects_ && !impl->isPayloadInFlight())
+      impl->objectNeeded(true);
+  }
+}
+
+void
+Namespace::Impl::onFreshnessTimer()
+{
+  RootState& rootState = *rootState_;
+  if (getIsShutDown())
+    return;
+
+  chrono::system_clock::time_point now = chrono::system_clock::now();
+  if (now >= rootState.freshnessTimerTime_)
+    // This is the pending timer. (An earlier timer may fire late.)
+    rootState.freshnessTimerTime_ = chrono::system_clock::time_point::max();
+  expireFreshness(now);
+
+  // Schedule the timer for the next expiry, using the Face of its node.
+  while (!rootState.freshnessExpiryQueue_.empty() &&
+         rootState.freshnessExpiryQueue_.top().getExpiryTime() <
+           rootState.freshnessTimerTime_) {
+    ptr_lib::shared_ptr<Namespace::Impl> impl =
+      rootState.freshnessExpiryQueue_.top().getImpl().lock();
+    if (!impl) {
+      // The node was removed.
+      rootState.freshnessExpiryQueue_.pop();
+      continue;
+    }
+
+    Face* face = impl->getFace_();
+    if (!face)
+      return;
+
+    chrono::system_clock::time_point expiryTime =
+      rootState.freshnessExpiryQueue_.top().getExpiryTime();
+    chrono::nanoseconds delay = chrono::duration_cast<chrono::nanoseconds>
+      (expiryTime - now);
+    if (delay.count() < 0)
+      delay = chrono::nanoseconds(0);
+    rootState.freshnessTimerTime_ = expiryTime;
+    face->callLater
+      (delay, bind(&Namespace::Impl::onFreshnessTimer, shared_from_this()));
+    return;
+  }
+}
+
+uint64_t
+Namespace::Impl::addOnDeserializeNeeded_
+  (const Handler::OnDeserializeNeeded& onDeserializeNeeded)
+{
+  uint64_t callbackId = getNextCallbackId();
+  if (onDeserializeNeededCallbacks_.empty())
+    invalidateNearestListeners();
+  onDeserializeNeededCallbacks_.add(callbackId, onDeserializeNeeded);
+  return callbackId;
+}
+
+void
+Namespace::Impl::deserialize_
+  (const Blob& blob, const Handler::OnObjectSet& onObjectSet)
+{
+  if (getIsShutDown())
+    return;
+
+  for (Namespace::Impl* impl = getNearestListener(LISTENER_DESERIALIZE_NEEDED);
+       impl; impl = impl->getNextListener(LISTENER_DESERIALIZE_NEEDED)) {
+    if (impl->fireOnDeserializeNeeded(*this, blob, onObjectSet)) {
+      // Wait for the Handler to set the object, if it hasn't yet.
+      if (state_ < NamespaceState_DESERIALIZING)
+        setState(NamespaceState_DESERIALIZING);
+      return;
+    }
+  }
+
+  // Debug: Check if the object has been set (even if canDeserialize returned false.)
+
+  // Just call defaultOnDeserialized immediately.
+  defaultOnDeserialized(ptr_lib::make_shared<BlobObject>(blob), onObjectSet);
+}
+
+Namespace&
+Namespace::Impl::createChild(const Name::Component& component, bool fireCallbacks)
+{
+  if (getIsShutDown())
+    throw runtime_error
+      ("Cannot create a child of this Namespace node because it is shut down");
+
+  RootState& rootState = getRootState();
+  if (!rootState.nodePool_)
+    rootState.nodePool_ = ptr_lib::make_shared<NamespaceNodePool>();
+  const ptr_lib::shared_ptr<NamespaceNodePool>& nodePool =
+    rootState.nodePool_;
+
+  // Construct the child in storage from the root's node pool. Every child has a
+  // shared_ptr to the same isShutDown_ flag.
+  void* childStorage = nodePool->allocate(sizeof(Namespace));
+  Namespace* childPointer;
+  try {
+    childPointer = new (childStorage) Namespace(nodePool, isShutDown_);
+  } catch (...) {
+    nodePool->deallocate(childStorage, sizeof(Namespace));
+    throw;
+  }
+  nodePool->updateNNodes(1);
+  // Only store the component. getName() builds the full name when needed.
+  childPointer->impl_->component_ = component;
+  childPointer->impl_->depth_ = depth_ + 1;
+  // The shared_ptr control block also comes from the node pool.
+  ptr_lib::shared_ptr<Namespace> child
+    (childPointer, NamespaceNodeDeleter(nodePool),
+     NamespaceNodeAllocator<Namespace>(nodePool));
+  child->impl_->parent_ = this;
+  child->impl_->root_ = root_;
+  children_[component] = child;
+  if (isSortedChildrenValid_) {
+    // Keep the sorted list if the child is added in order, which is the common
+    // case for segments and sequence numbers. Otherwise sort it when needed.
+    if (sortedChildren_.size() == 0 ||
+        sortedChildren_.back()->component_.compare(component) < 0)
+      sortedChildren_.push_back(child->impl_.get());
+    else
+      isSortedChildrenValid_ = false;
+  }
+
+  if (fireCallbacks)
+    child->impl_->announceName();
+
+  return *child;
+}
+
+void
+Namespace::Impl::announceName()
+{
+  if (state_ == NamespaceState_NAME_EXISTS)
+    setState(NamespaceState_NAME_EXISTS);
+  else if (getRootState().batchDepth_ == 0 && !getIsShutDown())
+    // A producer already set the object of this speculative node. (In a
+    // batch, commitBatch reports the node with its final state.)
+    fireStateChanged(NamespaceState_NAME_EXISTS);
+
+  // Sync this name under the same conditions that we report a NAME_EXISTS.
+  if (getRootState().fullPSync_) {
+    Namespace::Impl* syncNode = getSyncNode();
+    if (syncNode) {
+      // Only sync names to the specified depth.
+      int depth = depth_ - syncNode->depth_;
+
+      if (depth <= syncNode->syncDepth_)
+        // If createChild is called when onNamesUpdate receives a name from
+        //   fullPSync_, then publishName already has it and will ignore it.
+        getRootState().fullPSync_->publishName(buildName());
+    }
+  }
+}
+
+void
+Namespace::Impl::setState(NamespaceState state)
+{
+  if (getIsShutDown())
+    return;
+
+  state_ = state;
+
+  if (getRootState().batchDepth_ > 0) {
+    // commitBatch will fire the callbacks with the final state.
+    if (!isInBatch_) {
+      isInBatch_ = true;
+      getRootState().batchChangedNodes_.push_back(shared_from_this());
+    }
+    return;
+  }
+
+  fireStateChanged(state);
+}
+
+void
+Namespace::Impl::fireStateChanged(NamespaceState state)
+{
+  // Fire callbacks.
+  for (Namespace::Impl* impl = getNearestListener(LISTENER_STATE_CHANGED);
+       impl; impl = impl->getNextListener(LISTENER_STATE_CHANGED))
+    impl->fireOnStateChanged(outerNamespace_, state);
+
+  // Only make the list if there is an OnStateChangedBatch callback.
+  vector<Namespace*> changedNamespaces;
+  for (Namespace::Impl* impl = getNearestListener(LISTENER_STATE_CHANGED_BATCH);
+       impl; impl = impl->getNextListener(LISTENER_STATE_CHANGED_BATCH)) {
+    if (changedNamespaces.size() == 0)
+      changedNamespaces.push_back(&outerNamespace_);
+    impl->fireOnStateChangedBatch(changedNamespaces);
+  }
+}
+
+void
+Namespace::Impl::commitBatch()
+{
+  RootState& rootState = getRootState();
+  if (rootState.batchDepth_ <= 0)
+    throw runtime_error("commitBatch: There is no batch to commit");
+  if (--rootState.batchDepth_ > 0)
+    // Wait for the outermost batch.
+    return;
+
+  vector<ptr_lib::shared_ptr<Namespace::Impl>> changedNodes;
+  changedNodes.swap(rootState.batchChangedNodes_);
+  if (getIsShutDown())
+    return;
+
+  // For each changed node, fire the OnStateChanged callbacks once with the
+  // final state, and add it to the list of each parent which has an
+  // OnStateChangedBatch callback.
+  vector<ptr_lib::shared_ptr<Namespace::Impl>> batchListeners;
+  map<Namespace::Impl*, vector<Namespace*>> batchLists;
+  for (size_t i = 0; i < changedNodes.size(); ++i) {
+    Namespace::Impl& changedNode = *changedNodes[i];
+    changedNode.isInBatch_ = false;
+    if (changedNode.isDeleted_)
+      continue;
+
+    NamespaceState state = changedNode.state_;
+    // If a node is not deleted, then its parent Impl still exists.
+    for (Namespace::Impl* impl =
+           changedNode.getNearestListener(LISTENER_STATE_CHANGED);
+         impl && !impl->isDeleted_;
+         impl = impl->getNextListener(LISTENER_STATE_CHANGED))
+      impl->fireOnStateChanged(changedNode.outerNamespace_, state);
+
+    if (changedNode.isDeleted_)
+      // A callback removed the node.
+      continue;
+    for (Namespace::Impl* impl =
+           changedNode.getNearestListener(LISTENER_STATE_CHANGED_BATCH);
+         impl && !impl->isDeleted_;
+         impl = impl->getNextListener(LISTENER_STATE_CHANGED_BATCH)) {
+      vector<Namespace*>& batchList = batchLists[impl];
+      if (batchList.size() == 0)
+        batchListeners.push_back(impl->shared_from_this());
+      batchList.push_back(&changedNode.outerNamespace_);
+    }
+  }
+
+  for (size_t i = 0; i < batchListeners.size(); ++i) {
+    if (!batchListeners[i]->isDeleted_)
+      batchListeners[i]->fireOnStateChangedBatch
+        (batchLists[batchListeners[i].get()]);
+  }
+}
+
+void
+Namespace::Impl::fireOnStateChanged
+  (Namespace& changedNamespace, NamespaceState state)
+{
+  uint32_t stateMask = getStateMask(state);
+  if ((onStateChangedStateMask_ & stateMask) == 0)
+    // No callback for this state.
+    return;
+  if (getIsShutDown())
+    return;
+
+  size_t relativeDepth = changedNamespace.impl_->depth_ - depth_;
+  // The registry skips callbacks which are removed by a callback.
+  onStateChangedCallbacks_.dispatch
+    ([&](uint64_t callbackId, FilteredCallback<OnStateChanged>& callback) {
+      if (!callback.matches(stateMask, relativeDepth))
+        return false;
+
+      try {
+        callback.getCallback()
+          (outerNamespace_, changedNamespace, state, callbackId);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR("Namespace::fireOnStateChanged: Error in onStateChanged: " <<
+                   ex.what());
+      } catch (...) {
+        _LOG_ERROR("Namespace::fireOnStateChanged: Error in onStateChanged.");
+      }
+      return false;
+    });
+}
+
+void
+Namespace::Impl::fireOnStateChangedBatch
+  (const vector<Namespace*>& changedNamespaces)
+{
+  if (getIsShutDown())
+    return;
+
+  // The registry skips callbacks which are removed by a callback.
+  onStateChangedBatchCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnStateChangedBatch& onStateChangedBatch) {
+      try {
+        onStateChangedBatch(outerNamespace_, changedNamespaces, callbackId);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR
+          ("Namespace::fireOnStateChangedBatch: Error in onStateChangedBatch: " <<
+           ex.what());
+      } catch (...) {
+        _LOG_ERROR
+          ("Namespace::fireOnStateChangedBatch: Error in onStateChangedBatch.");
+      }
+      return false;
+    });
+}
+
+void
+Namespace::Impl::setValidateState(NamespaceValidateState validateState)
+{
+  if (getIsShutDown())
+    return;
+
+  validateState_ = validateState;
+
+  // Fire callbacks.
+  for (Namespace::Impl* impl =
+         getNearestListener(LISTENER_VALIDATE_STATE_CHANGED);
+       impl; impl = impl->getNextListener(LISTENER_VALIDATE_STATE_CHANGED))
+    impl->fireOnValidateStateChanged(outerNamespace_, validateState);
+}
+
 void
 Namespace::Impl::fireOnValidateStateChanged
   (Namespace& changedNamespace, NamespaceValidateState validateState)
 {
+  uint32_t validateStateMask = getValidateStateMask(validateState);
+  if ((onValidateStateChangedStateMask_ & validateStateMask) == 0)
+    // No callback for this validate state.
+    return;
   if (getIsShutDown())
     return;
 
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onValidateStateChangedCallbacks_.size());
-  for (map<uint64_t, OnValidateStateChanged>::iterator i =
-         onValidateStateChangedCallbacks_.begin();
-       i != onValidateStateChangedCallbacks_.end(); ++i)
-    keys.push_back(i->first);
+  size_t relativeDepth = changedNamespace.impl_->depth_ - depth_;
+  // The registry skips callbacks which are removed by a callback.
+  onValidateStateChangedCallbacks_.dispatch
+    ([&](uint64_t callbackId,
+         FilteredCallback<OnValidateStateChanged>& callback) {
+      if (!callback.matches(validateStateMask, relativeDepth))
+        return false;
 
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, OnValidateStateChanged>::iterator entry =
-      onValidateStateChangedCallbacks_.find(keys[i]);
-    if (entry != onValidateStateChangedCallbacks_.end()) {
       try {
-        entry->second
-          (outerNamespace_, changedNamespace, validateState, entry->first);
+        callback.getCallback()
+          (outerNamespace_, changedNamespace, validateState, callbackId);
       } catch (const std::exception& ex) {
         _LOG_ERROR
           ("Namespace::fireOnValidateStateChanged: Error in onValidateStateChanged: " <<
@@ -700,8 +1869,8 @@ Namespace::Impl::fireOnValidateStateChanged
         _LOG_ERROR
           ("Namespace::fireOnValidateStateChanged: Error in onValidateStateChanged.");
       }
-    }
-  }
+      return false;
+    });
 }
 
 bool
@@ -710,21 +1879,12 @@ Namespace::Impl::fireOnObjectNeeded(Namespace& neededNamespace)
   if (getIsShutDown())
     return false;
 
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onObjectNeededCallbacks_.size());
-  for (map<uint64_t, OnObjectNeeded>::iterator i = onObjectNeededCallbacks_.begin();
-       i != onObjectNeededCallbacks_.end(); ++i)
-    keys.push_back(i->first);
-
+  // The registry skips callbacks which are removed by a callback.
   bool canProduce = false;
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, OnObjectNeeded>::iterator entry =
-      onObjectNeededCallbacks_.find(keys[i]);
-    if (entry != onObjectNeededCallbacks_.end()) {
+  onObjectNeededCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnObjectNeeded& onObjectNeeded) {
       try {
-        if (entry->second(outerNamespace_, neededNamespace, entry->first))
+        if (onObjectNeeded(outerNamespace_, neededNamespace, callbackId))
           canProduce = true;
       } catch (const std::exception& ex) {
         _LOG_ERROR("Namespace::fireOnObjectNeeded: Error in onObjectNeeded: " <<
@@ -732,8 +1892,8 @@ Namespace::Impl::fireOnObjectNeeded(Namespace& neededNamespace)
       } catch (...) {
         _LOG_ERROR("Namespace::fireOnObjectNeeded: Error in onObjectNeeded.");
       }
-    }
-  }
+      return false;
+    });
 
   return canProduce;
 }
@@ -750,30 +1910,22 @@ Namespace::Impl::fireOnDeserializeNeeded
     bind(&Namespace::Impl::defaultOnDeserialized,
          blobNamespaceImpl.shared_from_this(), _1, onObjectSet);
 
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onDeserializeNeededCallbacks_.size());
-  for (map<uint64_t, Handler::OnDeserializeNeeded>::iterator i = onDeserializeNeededCallbacks_.begin();
-       i != onDeserializeNeededCallbacks_.end(); ++i)
-    keys.push_back(i->first);
-
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, Handler::OnDeserializeNeeded>::iterator entry =
-      onDeserializeNeededCallbacks_.find(keys[i]);
-    if (entry != onDeserializeNeededCallbacks_.end()) {
-      try {
-        if (entry->second
-            (blobNamespaceImpl.outerNamespace_, blob, onDeserialized, entry->first))
-          return true;
-      } catch (const std::exception& ex) {
-        _LOG_ERROR("Namespace::fireOnDeserializeNeeded: Error in onDeserializeNeeded: " <<
-                   ex.what());
-      } catch (...) {
-        _LOG_ERROR("Namespace::fireOnDeserializeNeeded: Error in onDeserializeNeeded.");
-      }
-    }
-  }
+  // The registry skips callbacks which are removed by a callback.
+  if (onDeserializeNeededCallbacks_.dispatch
+      ([&](uint64_t callbackId, Handler::OnDeserializeNeeded& onDeserializeNeeded) {
+        try {
+          // Stop at the first callback which will deserialize.
+          return onDeserializeNeeded
+            (blobNamespaceImpl.outerNamespace_, blob, onDeserialized, callbackId);
+        } catch (const std::exception& ex) {
+          _LOG_ERROR("Namespace::fireOnDeserializeNeeded: Error in onDeserializeNeeded: " <<
+                     ex.what());
+        } catch (...) {
+          _LOG_ERROR("Namespace::fireOnDeserializeNeeded: Error in onDeserializeNeeded.");
+        }
+        return false;
+      }))
+    return true;
 
   return false;
 }
@@ -787,6 +1939,7 @@ Namespace::Impl::defaultOnDeserialized
     return;
 
   object_ = object;
+  updatePayload();
   setState(NamespaceState_OBJECT_READY);
 
   if (onObjectSet)
@@ -808,68 +1961,167 @@ Namespace::Impl::onInterest
     // Strip the implicit digest.
     interestName = interestName.getPrefix(-1);
 
-  if (!name_.isPrefixOf(interestName))
+  if (!isPrefixOfName(interestName))
     // No match.
     return;
 
-  // Check if the Namespace node exists and has a matching Data packet.
-  Namespace::Impl& interestNamespaceImpl = getChildImpl(interestName);
-  if (hasChild(interestName)) {
-    Namespace::Impl* bestMatch = findBestMatchName
-      (interestNamespaceImpl, *interest, chrono::system_clock::now());
+  // Mark Data packets whose freshness period has ended, in case the timer
+  // hasn't run yet.
+  root_->expireFreshness(chrono::system_clock::now());
+
+  RootState& rootState = getRootState();
+  PendingIncomingInterestTable& pendingIncomingInterestTable =
+    *rootState.pendingIncomingInterestTable_;
+  // Only use the counters from setFace or addFace.
+  FaceCounters* faceCounters =
+    pendingIncomingInterestTable.findFaceCounters(&face);
+  if (!faceCounters)
+    // The face was removed, so don't answer or keep a reference to it.
+    return;
+  ++faceCounters->nInInterests_;
+
+  // Check if the Namespace node exists and has a matching Data packet. Don't
+  // create nodes for this check. (If the node doesn't exist, then no node has
+  // a Data packet with the Interest name as a prefix.)
+  Namespace::Impl* deepestImpl = findDeepestImpl(interestName);
+  if (deepestImpl->depth_ == interestName.size()) {
+    Namespace::Impl* bestMatch = findBestMatchName(*deepestImpl, *interest);
     if (bestMatch) {
-      // findBestMatchName makes sure there is a data_ packet.
-      face.putData(*bestMatch->data_);
+      // findBestMatchName makes sure there is a data_ packet. Send the saved
+      // encoding instead of encoding again.
+      face.send(bestMatch->dataWireEncoding_);
+      ++faceCounters->nOutData_;
+      bestMatch->touchPayload();
       return;
     }
   }
 
   // No Data packet found, so save the pending Interest.
-  root_->pendingIncomingInterestTable_->add(interest, face);
+  if (pendingIncomingInterestTable.add(interest, face) !=
+      PendingIncomingInterestTable::ADDED)
+    // A duplicate or the table is full, or another Interest for the name is
+    // pending so that the producers were already asked.
+    return;
+
+  // Only create the node for the Interest name if there is an OnObjectNeeded
+  // callback which may claim it.
+  if (!deepestImpl->getNearestListener(LISTENER_OBJECT_NEEDED))
+    return;
+
+  Namespace::Impl* interestNamespaceImpl = deepestImpl;
+  // The nodes created for the Interest name, from the highest to the leaf.
+  vector<ptr_lib::shared_ptr<Namespace::Impl>> createdNodes;
+  bool isSpeculative = (deepestImpl->depth_ < interestName.size());
+  if (isSpeculative) {
+    if (!rootState.nSpeculativeNodes_)
+      rootState.nSpeculativeNodes_ = ptr_lib::make_shared<size_t>(0);
+    if (*rootState.nSpeculativeNodes_ >= rootState.maxSpeculativeNodes_) {
+      _LOG_DEBUG("Namespace::onInterest: Reached the maximum number of speculative nodes. Not creating " <<
+                 interestName);
+      // The producers are not asked, so don't leave the Interest pending
+      // where it would cause later Interests for the name to be aggregated.
+      pendingIncomingInterestTable.remove(*interest, face);
+      // The table's overload policy may have called a callback which removed
+      // the face, so find the counters again.
+      faceCounters = pendingIncomingInterestTable.findFaceCounters(&face);
+      if (faceCounters)
+        ++faceCounters->nDroppedInterests_;
+      return;
+    }
+
+    // Create the nodes without firing callbacks until a producer claims it.
+    while (interestNamespaceImpl->depth_ < interestName.size()) {
+      interestNamespaceImpl = interestNamespaceImpl->createChild
+        (interestName[interestNamespaceImpl->depth_], false).impl_.get();
+      createdNodes.push_back(interestNamespaceImpl->shared_from_this());
+    }
+    interestNamespaceImpl->speculativeNodeCount_ = rootState.nSpeculativeNodes_;
+    ++*rootState.nSpeculativeNodes_;
+  }
+  // Hold the node in case a callback removes it.
+  ptr_lib::shared_ptr<Namespace::Impl> interestNamespaceImplHolder =
+    interestNamespaceImpl->shared_from_this();
 
   // Ask all OnObjectNeeded callbacks if they can produce.
   bool canProduce = false;
-  Namespace::Impl* impl = &interestNamespaceImpl;
-  while (impl) {
-    if (impl->fireOnObjectNeeded(interestNamespaceImpl.outerNamespace_))
+  for (Namespace::Impl* impl =
+         interestNamespaceImpl->getNearestListener(LISTENER_OBJECT_NEEDED);
+       impl; impl = impl->getNextListener(LISTENER_OBJECT_NEEDED)) {
+    if (impl->fireOnObjectNeeded(interestNamespaceImpl->outerNamespace_))
       canProduce = true;
-    impl = impl->parent_;
   }
-  if (canProduce)
-    interestNamespaceImpl.setState(NamespaceState_PRODUCING_OBJECT);
+
+  if (canProduce) {
+    if (isSpeculative) {
+      // A producer claimed the name, so the node is no longer speculative.
+      interestNamespaceImpl->clearSpeculative();
+      // Now report each new name, including the leaf if the producer already
+      // set the object.
+      for (size_t i = 0; i < createdNodes.size(); ++i) {
+        if (!createdNodes[i]->isDeleted_)
+          createdNodes[i]->announceName();
+      }
+    }
+    if (!interestNamespaceImpl->data_ && !interestNamespaceImpl->object_)
+      // The producer will set the object later.
+      interestNamespaceImpl->setState(NamespaceState_PRODUCING_OBJECT);
+  }
+  else if (isSpeculative)
+    // Remove the nodes that we created, unless a callback started using them.
+    interestNamespaceImpl->removeIfEmpty(deepestImpl);
+}
+
+Namespace::Impl*
+Namespace::Impl::findDeepestImpl(const Name& descendantName)
+{
+  Namespace::Impl* descendantImpl = this;
+  while (descendantImpl->depth_ < descendantName.size()) {
+    ChildMap::iterator child = descendantImpl->children_.find
+      (descendantName[descendantImpl->depth_]);
+    if (child == descendantImpl->children_.end())
+      break;
+    descendantImpl = child->second->impl_.get();
+  }
+
+  return descendantImpl;
 }
 
 Namespace::Impl*
 Namespace::Impl::findBestMatchName
-  (Namespace::Impl& nameSpace, const Interest& interest,
-   chrono::system_clock::time_point nowTimePoint)
+  (Namespace::Impl& nameSpace, const Interest& interest)
 {
   Namespace::Impl *bestMatch = 0;
 
-  // Search the children backwards which will result in a "less than" name
-  // among names of the same length.
-  for (map<Name::Component, ptr_lib::shared_ptr<Namespace>>::reverse_iterator
-        i = nameSpace.children_.rbegin();
-       i != nameSpace.children_.rend(); ++i) {
-    Namespace::Impl& child = *i->second->impl_;
-    Namespace::Impl* childBestMatch = findBestMatchName
-      (child, interest, nowTimePoint);
-
-    if (childBestMatch &&
-        (!bestMatch ||
-         childBestMatch->name_.size() >= bestMatch->name_.size()))
-      bestMatch = childBestMatch;
+  if (nameSpace.nDataNodes_ > (nameSpace.data_ ? 1 : 0)) {
+    // Search the children forwards and only replace a match with a longer one,
+    // which results in a "less than" name among names of the same length.
+    const vector<Namespace::Impl*>& sortedChildren =
+      nameSpace.getSortedChildren();
+    for (vector<Namespace::Impl*>::const_iterator i = sortedChildren.begin();
+         i != sortedChildren.end(); ++i) {
+      Namespace::Impl& child = **i;
+      if (child.nDataNodes_ == 0 ||
+          (bestMatch && child.maxDataDepth_ <= bestMatch->depth_))
+        // The child's subtree can't have a longer match.
+        continue;
+
+      Namespace::Impl* childBestMatch = findBestMatchName(child, interest);
+      if (childBestMatch &&
+          (!bestMatch || childBestMatch->depth_ > bestMatch->depth_)) {
+        bestMatch = childBestMatch;
+        if (bestMatch->depth_ >= nameSpace.maxDataDepth_)
+          // No other child can have a longer match.
+          break;
+      }
+    }
   }
 
   if (bestMatch)
     // We have a child match, and it is longer than this name, so return it.
     return bestMatch;
 
-  if (interest.getMustBeFresh() &&
-      nameSpace.freshnessExpiryTime_ != chrono::system_clock::time_point::min() &&
-      nowTimePoint >= nameSpace.freshnessExpiryTime_)
+  if (interest.getMustBeFresh() && nameSpace.isStale_)
     // The Data packet is no longer fresh.
-    // Debug: When to set the state to OBJECT_READY_BUT_STALE?
     return 0;
 
   if (nameSpace.data_ && interest.matchesData(*nameSpace.data_))
@@ -883,9 +2135,18 @@ Namespace::Impl::onData
   (const ptr_lib::shared_ptr<const Interest>& interest,
    const ptr_lib::shared_ptr<Data>& data)
 {
-  if (getIsShutDown())
+  if (getIsShutDown() || isDeleted_)
+    // If the node was removed from the tree, the root may be deleted.
     return;
 
+  removeOutgoingInterest();
+  if (canMeasureRtt_) {
+    canMeasureRtt_ = false;
+    getRttEstimator().addMeasurement
+      (chrono::steady_clock::now() - interestSendTime_);
+  }
+  // Reset the negative cache backoff.
+  clearNegativeCacheEntry();
   Namespace::Impl& dataNamespaceImpl = getChildImpl(data->getName());
   if (!dataNamespaceImpl.setData(data))
     // A Data packet is already attached.
@@ -921,12 +2182,95 @@ Namespace::Impl::onData
      bind(&Namespace::Impl::onDecryptionError, shared_from_this(), _1, _2));
 }
 
+RttEstimator&
+Namespace::Impl::getRttEstimator()
+{
+  RootState& rootState = getRootState();
+  if (!rootState.rttEstimator_)
+    rootState.rttEstimator_ = ptr_lib::make_shared<RttEstimator>();
+  return *rootState.rttEstimator_;
+}
+
+void
+Namespace::Impl::expressInterest
+  (Face* face, const Interest& interest, bool isRetransmission)
+{
+  // Only replace the serial of an earlier Interest if this one is expressed.
+  uint64_t interestSerial = interestSerial_ + 1;
+  chrono::steady_clock::time_point sendTime = chrono::steady_clock::now();
+  try {
+    face->expressInterest
+      (interest,
+       bind(&Namespace::Impl::onData, shared_from_this(), _1, _2),
+       bind(&Namespace::Impl::onInterestTimeout, shared_from_this(), _1,
+            interestSerial),
+       bind(&Namespace::Impl::onNetworkNack, shared_from_this(), _1, _2,
+            interestSerial));
+  } catch (...) {
+    if (!isRetransmission)
+      // No Interest is in flight for the entry that objectNeeded added.
+      removeOutgoingInterest();
+    throw;
+  }
+
+  interestSerial_ = interestSerial;
+  interestSendTime_ = sendTime;
+  canMeasureRtt_ = !isRetransmission;
+}
+
+chrono::nanoseconds
+Namespace::Impl::getNewInterestLifetime()
+{
+  return min(getRttEstimator().getRto(), getMaxInterestLifetime());
+}
+
+void
+Namespace::Impl::onInterestTimeout
+  (const ptr_lib::shared_ptr<const Interest>& interest, uint64_t interestSerial)
+{
+  if (getIsShutDown() || isDeleted_)
+    return;
+  if (interestSerial != interestSerial_)
+    // This node expressed another Interest which will report the result.
+    return;
+
+  // This only backs off once for the Interests which were sent with the same
+  // retransmission timeout.
+  getRttEstimator().backoffRto(interestSendTime_);
+
+  chrono::nanoseconds lifetime = interest->getInterestLifetime() * 2;
+  Face* face = getFace_();
+  if (lifetime > getMaxInterestLifetime() || !face) {
+    onTimeout(interest);
+    return;
+  }
+
+  _LOG_DEBUG("Re-express interest: " << interest->getName());
+  Interest retransmittedInterest(*interest);
+  retransmittedInterest.setInterestLifetime(lifetime);
+  retransmittedInterest.refreshNonce();
+  try {
+    expressInterest(face, retransmittedInterest, true);
+  } catch (const std::exception& ex) {
+    _LOG_ERROR("Namespace::onInterestTimeout: Error re-expressing the Interest: " <<
+               ex.what());
+    // No Interest is in flight, so report the timeout.
+    onTimeout(interest);
+    return;
+  }
+
+  // Report each retransmission so that a fetcher can react to the timeout.
+  root_->fireOnInterestRetransmitted(outerNamespace_);
+}
+
 void
 Namespace::Impl::onTimeout(const ptr_lib::shared_ptr<const Interest>& interest)
 {
-  if (getIsShutDown())
+  if (getIsShutDown() || isDeleted_)
     return;
 
+  removeOutgoingInterest();
+  addNegativeCacheEntry(0);
   // TODO: Need to detect a timeout on a child node.
   setState(NamespaceState_INTEREST_TIMEOUT);
 }
@@ -934,11 +2278,16 @@ Namespace::Impl::onTimeout(const ptr_lib::shared_ptr<const Interest>& interest)
 void
 Namespace::Impl::onNetworkNack
   (const ptr_lib::shared_ptr<const Interest>& interest,
-   const ptr_lib::shared_ptr<NetworkNack>& networkNack)
+   const ptr_lib::shared_ptr<NetworkNack>& networkNack, uint64_t interestSerial)
 {
-  if (getIsShutDown())
+  if (getIsShutDown() || isDeleted_)
+    return;
+  if (interestSerial != interestSerial_)
+    // This node expressed another Interest which will report the result.
     return;
 
+  removeOutgoingInterest();
+  addNegativeCacheEntry(networkNack.get());
   // TODO: Need to detect a network nack on a child node.
   networkNack_ = networkNack;
   setState(NamespaceState_INTEREST_NETWORK_NACK);
@@ -966,7 +2315,7 @@ Namespace::Impl::onNamesUpdate
 
   for (vector<Name>::const_iterator name = names->begin(); name != names->end();
        ++name) {
-    if (!name_.isPrefixOf(*name)) {
+    if (!isPrefixOfName(*name)) {
       _LOG_DEBUG("The Namespace root name is not a prefix of the sync update name " <<
                  *name);
       continue;
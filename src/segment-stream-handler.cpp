@@ -54,7 +54,11 @@ SegmentStreamHandler::onNamespaceSet()
 SegmentStreamHandler::Impl::Impl(const OnSegment& onSegment)
 : maxReportedSegmentNumber_(-1), didRequestFinalSegment_(false),
   finalSegmentNumber_(-1), interestPipelineSize_(8), initialInterestCount_(1),
-  onObjectNeededId_(0), onStateChangedId_(0), namespace_(0),
+  nRetransmissions_(0), maxSegmentRetries_(3), bufferedBytes_(0),
+  maxBufferedBytes_(0), maxReceivedSegmentSize_(0),
+  maxReceivedSegmentNumber_(-1), maxRequestedSegmentNumber_(-1),
+  onObjectNeededId_(0), onStateChangedId_(0), onInterestRetransmittedId_(0),
+  namespace_(0),
   maxSegmentPayloadLength_(8192)
 {
   if (onSegment)
@@ -65,14 +69,24 @@ uint64_t
 SegmentStreamHandler::Impl::addOnSegment(const OnSegment& onSegment)
 {
   uint64_t callbackId = Namespace::getNextCallbackId();
-  onSegmentCallbacks_[callbackId] = onSegment;
+  onSegmentCallbacks_.add(callbackId, onSegment);
+  return callbackId;
+}
+
+uint64_t
+SegmentStreamHandler::Impl::addOnSegmentFailed
+  (const OnSegmentFailed& onSegmentFailed)
+{
+  uint64_t callbackId = Namespace::getNextCallbackId();
+  onSegmentFailedCallbacks_.add(callbackId, onSegmentFailed);
   return callbackId;
 }
 
 void
 SegmentStreamHandler::Impl::removeCallback(uint64_t callbackId)
 {
-  onSegmentCallbacks_.erase(callbackId);
+  if (!onSegmentCallbacks_.remove(callbackId))
+    onSegmentFailedCallbacks_.remove(callbackId);
 }
 
 void
@@ -83,6 +97,14 @@ SegmentStreamHandler::Impl::setInterestPipelineSize(int interestPipelineSize)
   interestPipelineSize_ = interestPipelineSize;
 }
 
+void
+SegmentStreamHandler::Impl::setMaxSegmentRetries(int maxSegmentRetries)
+{
+  if (maxSegmentRetries < 0)
+    throw runtime_error("The maximum segment retries must not be negative");
+  maxSegmentRetries_ = maxSegmentRetries;
+}
+
 void
 SegmentStreamHandler::Impl::setInitialInterestCount(int initialInterestCount)
 {
@@ -117,7 +139,25 @@ SegmentStreamHandler::Impl::setObject
     finalSegment = segment;
     ++segment;
   }
+  // Defer the state change callbacks for the segments until all are set.
+  nameSpace.beginBatch();
+  try {
+    setSegments(nameSpace, object, useSignatureManifest, keyChain, finalSegment);
+  } catch (...) {
+    nameSpace.commitBatch();
+    throw;
+  }
+  nameSpace.commitBatch();
+}
+
+void
+SegmentStreamHandler::Impl::setSegments
+  (Namespace& nameSpace, const ndn::Blob& object, bool useSignatureManifest,
+   KeyChain* keyChain, uint64_t finalSegment)
+{
   Name::Component finalBlockId = Name().appendSegment(finalSegment)[0];
+  // Build the name once for all the segments.
+  Name objectName = nameSpace.getName();
 
   ptr_lib::shared_ptr<vector<uint8_t> > manifestContent;
   DigestSha256Signature digestSignature;
@@ -133,7 +173,9 @@ SegmentStreamHandler::Impl::setObject
     digestSignature.setSignature(Blob(zeros, false));
   }
 
-  segment = 0;
+  vector<ptr_lib::shared_ptr<Data>> segments;
+  segments.reserve(finalSegment + 1);
+  uint64_t segment = 0;
   for (size_t offset = 0; offset < object.size();
        offset += maxSegmentPayloadLength_) {
     size_t payloadLength = maxSegmentPayloadLength_;
@@ -141,9 +183,8 @@ SegmentStreamHandler::Impl::setObject
       payloadLength = object.size() - offset;
 
     // Make the Data packet.
-    Namespace& segmentNamespace = nameSpace[Name::Component::fromSegment(segment)];
-    ptr_lib::shared_ptr<Data> data =
-      ptr_lib::make_shared<Data>(segmentNamespace.getName());
+    ptr_lib::shared_ptr<Data> data = ptr_lib::make_shared<Data>
+      (Name(objectName).appendSegment(segment));
 
     const MetaInfo* metaInfo = nameSpace.getNewDataMetaInfo_();
     if (metaInfo)
@@ -165,11 +206,13 @@ SegmentStreamHandler::Impl::setObject
     else
       keyChain->sign(*data);
 
-    segmentNamespace.setData(data);
-
+    segments.push_back(data);
     ++segment;
   }
 
+  // Attach the segments and satisfy pending Interests in one pass.
+  nameSpace.addData(segments);
+
   if (useSignatureManifest)
     // Create the _manifest data packet.
     nameSpace[getNAME_COMPONENT_MANIFEST()].serializeObject
@@ -211,8 +254,14 @@ SegmentStreamHandler::Impl::onNamespaceSet(Namespace* nameSpace)
 
   onObjectNeededId_ = namespace_->addOnObjectNeeded
     (bind(&SegmentStreamHandler::Impl::onObjectNeeded, shared_from_this(), _1, _2, _3));
+  // Only report these states for the immediate children.
   onStateChangedId_ = namespace_->addOnStateChanged
-    (bind(&SegmentStreamHandler::Impl::onStateChanged, shared_from_this(), _1, _2, _3, _4));
+    (bind(&SegmentStreamHandler::Impl::onStateChanged, shared_from_this(), _1, _2, _3, _4),
+     Namespace::getStateMask(NamespaceState_OBJECT_READY) |
+     Namespace::getStateMask(NamespaceState_INTEREST_TIMEOUT) |
+     Namespace::getStateMask(NamespaceState_INTEREST_NETWORK_NACK), 1);
+  onInterestRetransmittedId_ = namespace_->addOnInterestRetransmitted
+    (bind(&SegmentStreamHandler::Impl::onInterestRetransmitted, shared_from_this(), _1, _2, _3));
 }
 
 bool
@@ -226,22 +275,87 @@ SegmentStreamHandler::Impl::onObjectNeeded
   return true;
 }
 
+void
+SegmentStreamHandler::Impl::onInterestRetransmitted
+  (Namespace& nameSpace, Namespace& retransmittedNamespace, uint64_t callbackId)
+{
+  // The callback is kept by the root, so check for one of our segments.
+  if (retransmittedNamespace.getParent() != namespace_ ||
+      !retransmittedNamespace.getNameComponent().isSegment())
+    return;
+
+  // Report each timeout in the retry chain, not only the final timeout.
+  if (interestWindowController_) {
+    interestWindowController_->setRetransmissionTimeout
+      (namespace_->getRetransmissionTimeout());
+    interestWindowController_->onTimeout();
+  }
+}
+
 void
 SegmentStreamHandler::Impl::onStateChanged
   (Namespace& nameSpace, Namespace& changedNamespace, NamespaceState state,
    uint64_t callbackId)
 {
-  if (!(state == NamespaceState_OBJECT_READY &&
-        changedNamespace.getName().size() == namespace_->getName().size() + 1 &&
-        changedNamespace.getName()[-1].isSegment()))
+  // addOnStateChanged only reports the states in the mask for the children.
+  if (!changedNamespace.getNameComponent().isSegment())
     // Not a segment, ignore.
     return;
 
+  if (state == NamespaceState_INTEREST_TIMEOUT) {
+    if (interestWindowController_) {
+      interestWindowController_->setRetransmissionTimeout
+        (namespace_->getRetransmissionTimeout());
+      interestWindowController_->onTimeout();
+    }
+    onSegmentFailure(changedNamespace);
+    return;
+  }
+  if (state == NamespaceState_INTEREST_NETWORK_NACK) {
+    if (interestWindowController_ && changedNamespace.getNetworkNack() &&
+        changedNamespace.getNetworkNack()->getReason() ==
+          ndn_NetworkNackReason_CONGESTION) {
+      interestWindowController_->setRetransmissionTimeout
+        (namespace_->getRetransmissionTimeout());
+      interestWindowController_->onCongestionNack();
+    }
+    onSegmentFailure(changedNamespace);
+    return;
+  }
+
+  if (interestWindowController_) {
+    if (changedNamespace.getData()->getCongestionMark() > 0)
+      interestWindowController_->onCongestionMark();
+    else
+      interestWindowController_->onData();
+  }
+
   MetaInfo& metaInfo = changedNamespace.getData()->getMetaInfo();
   if (metaInfo.getFinalBlockId().getValue().size() > 0 &&
       metaInfo.getFinalBlockId().isSegment())
     finalSegmentNumber_ = metaInfo.getFinalBlockId().toSegment();
 
+  int segmentNumber = changedNamespace.getNameComponent().toSegment();
+  // Count the Data packet and object which the node holds while buffered.
+  size_t segmentSize = changedNamespace.getNodePayloadBytes();
+  maxReceivedSegmentSize_ = max(maxReceivedSegmentSize_, segmentSize);
+  if (segmentNumber > maxReportedSegmentNumber_ &&
+      bufferedSegments_.find(segmentNumber) == bufferedSegments_.end()) {
+    // Buffer until the segments before it are reported.
+    bufferedSegments_[segmentNumber] = segmentSize;
+    bufferedBytes_ += segmentSize;
+  }
+
+  // Track the segments skipped by this one as missing.
+  for (int missingSegmentNumber = max
+         (maxReceivedSegmentNumber_, maxReportedSegmentNumber_) + 1;
+       missingSegmentNumber < segmentNumber; ++missingSegmentNumber)
+    nLaterSegments_[missingSegmentNumber] = 0;
+  maxReceivedSegmentNumber_ = max(maxReceivedSegmentNumber_, segmentNumber);
+  nLaterSegments_.erase(segmentNumber);
+
+  retransmitMissingSegments(segmentNumber);
+
   // Report as many segments as possible where the node already has content.
   while (true) {
     int nextSegmentNumber = maxReportedSegmentNumber_ + 1;
@@ -251,7 +365,14 @@ SegmentStreamHandler::Impl::onStateChanged
       break;
 
     maxReportedSegmentNumber_ = nextSegmentNumber;
-    fireOnSegment(&nextSegment);
+    nLaterSegments_.erase(nextSegmentNumber);
+    nSegmentRetries_.erase(nextSegmentNumber);
+    map<int, size_t>::iterator bufferedSegment =
+      bufferedSegments_.find(nextSegmentNumber);
+    if (bufferedSegment != bufferedSegments_.end()) {
+      bufferedBytes_ -= bufferedSegment->second;
+      bufferedSegments_.erase(bufferedSegment);
+    }
 
     if (dynamic_cast<const DigestSha256Signature *>
         (nextSegment.getData()->getSignature())) {
@@ -262,20 +383,29 @@ SegmentStreamHandler::Impl::onStateChanged
         manifestNamespace.objectNeeded();
     }
 
+    // Check the signature first since onSegment may release the segment.
+    fireOnSegment(&nextSegment);
+
     if (finalSegmentNumber_ >= 0 && nextSegmentNumber == finalSegmentNumber_) {
       // Finished.
       fireOnSegment(0);
 
       // Free resources that won't be used anymore.
       onSegmentCallbacks_.clear();
+      onSegmentFailedCallbacks_.clear();
+      nLaterSegments_.clear();
+      nSegmentRetries_.clear();
+      bufferedSegments_.clear();
+      bufferedBytes_ = 0;
       namespace_->removeCallback(onObjectNeededId_);
       namespace_->removeCallback(onStateChangedId_);
+      namespace_->removeCallback(onInterestRetransmittedId_);
 
       return;
     }
   }
 
-  requestNewSegments(interestPipelineSize_);
+  requestNewSegments(getInterestWindowSize());
 }
 
 void
@@ -284,19 +414,16 @@ SegmentStreamHandler::Impl::requestNewSegments(int maxRequestedSegments)
   if (maxRequestedSegments < 1)
     maxRequestedSegments = 1;
 
-  ptr_lib::shared_ptr<vector<Name::Component>> childComponents =
-    namespace_->getChildComponents();
-  // First, count how many are already requested and not received.
+  // First, count how many are already requested and not received. Only the
+  // segments after the in-order point can be in flight.
   int nRequestedSegments = 0;
-  for (vector<Name::Component>::iterator component = childComponents->begin();
-       component != childComponents->end(); ++component) {
-    if (!component->isSegment())
-      // The namespace contains a child other than a segment. Ignore.
-      continue;
-
-    Namespace& child = (*namespace_)[*component];
+  for (int segmentNumber = maxReportedSegmentNumber_ + 1;
+       segmentNumber <= maxRequestedSegmentNumber_; ++segmentNumber) {
+    Namespace& child = (*namespace_)[
+      Name::Component::fromSegment(segmentNumber)];
+    // A segment which timed out or got a Nack is not in flight.
     if (!child.getData() &&
-        child.getState() >= NamespaceState_INTEREST_EXPRESSED) {
+        child.getState() == NamespaceState_INTEREST_EXPRESSED) {
       ++nRequestedSegments;
       if (nRequestedSegments >= maxRequestedSegments)
         // Already maxed out on requests.
@@ -318,35 +445,108 @@ SegmentStreamHandler::Impl::requestNewSegments(int maxRequestedSegments)
       // Already got the data packet or already requested.
       continue;
 
+    if (maxBufferedBytes_ > 0 && segmentNumber > maxReportedSegmentNumber_ + 1 &&
+        bufferedBytes_ + (nRequestedSegments + 1) * maxReceivedSegmentSize_ >
+          maxBufferedBytes_)
+      // Always request the next segment in order, but don't request more
+      // segments which could exceed the buffer.
+      break;
+
     ++nRequestedSegments;
+    maxRequestedSegmentNumber_ = max(maxRequestedSegmentNumber_, segmentNumber);
     segment.objectNeeded();
   }
 }
 
+void
+SegmentStreamHandler::Impl::onSegmentFailure(Namespace& segment)
+{
+  int segmentNumber = segment.getNameComponent().toSegment();
+  if (segmentNumber <= maxReportedSegmentNumber_ || segment.getData())
+    // We don't need the segment anymore.
+    return;
+
+  int& nRetries = nSegmentRetries_[segmentNumber];
+  if (nRetries >= maxSegmentRetries_) {
+    _LOG_DEBUG("SegmentStreamHandler: Giving up on segment " << segmentNumber);
+    fireOnSegmentFailed(&segment);
+    return;
+  }
+
+  ++nRetries;
+  _LOG_DEBUG("SegmentStreamHandler: Retrying segment " << segmentNumber);
+  // Otherwise objectNeeded only replays the failure from the negative cache.
+  segment.clearNegativeCacheEntry();
+  segment.objectNeeded();
+}
+
+void
+SegmentStreamHandler::Impl::retransmitMissingSegments(int receivedSegmentNumber)
+{
+  for (map<int, int>::iterator missing = nLaterSegments_.begin();
+       missing != nLaterSegments_.end() &&
+       missing->first < receivedSegmentNumber;
+       ++missing) {
+    int& nLaterSegments = missing->second;
+    ++nLaterSegments;
+    if (nLaterSegments < 3)
+      continue;
+
+    Namespace& segment = (*namespace_)[
+      Name::Component::fromSegment(missing->first)];
+    if (segment.getData())
+      // The Data packet arrived but the object is not ready yet.
+      continue;
+
+    if (segment.reExpressInterest()) {
+      _LOG_DEBUG("SegmentStreamHandler: Re-expressing missing segment " <<
+                 missing->first);
+      ++nRetransmissions_;
+      if (interestWindowController_) {
+        interestWindowController_->setRetransmissionTimeout
+          (namespace_->getRetransmissionTimeout());
+        interestWindowController_->onTimeout();
+      }
+    }
+    // Segments requested before the retransmission may still arrive, so wait
+    // for another window of later segments before re-expressing again.
+    nLaterSegments = -getInterestWindowSize();
+  }
+}
+
 void
 SegmentStreamHandler::Impl::fireOnSegment(Namespace* segmentNamespace)
 {
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onSegmentCallbacks_.size());
-  for (map<uint64_t, OnSegment>::iterator i = onSegmentCallbacks_.begin();
-       i != onSegmentCallbacks_.end(); ++i)
-    keys.push_back(i->first);
-
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, OnSegment>::iterator entry = onSegmentCallbacks_.find(keys[i]);
-    if (entry != onSegmentCallbacks_.end()) {
+  // The registry skips callbacks which are removed by a callback.
+  onSegmentCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnSegment& onSegment) {
       try {
-        entry->second(segmentNamespace);
+        onSegment(segmentNamespace);
       } catch (const std::exception& ex) {
         _LOG_ERROR("SegmentStreamHandler::fireOnSegment: Error in onSegment: " <<
                    ex.what());
       } catch (...) {
         _LOG_ERROR("SegmentStreamHandler::fireOnSegment: Error in onSegment.");
       }
-    }
-  }
+      return false;
+    });
+}
+
+void
+SegmentStreamHandler::Impl::fireOnSegmentFailed(Namespace* segmentNamespace)
+{
+  onSegmentFailedCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnSegmentFailed& onSegmentFailed) {
+      try {
+        onSegmentFailed(segmentNamespace);
+      } catch (const std::exception& ex) {
+        _LOG_ERROR("SegmentStreamHandler::fireOnSegmentFailed: Error in onSegmentFailed: " <<
+                   ex.what());
+      } catch (...) {
+        _LOG_ERROR("SegmentStreamHandler::fireOnSegmentFailed: Error in onSegmentFailed.");
+      }
+      return false;
+    });
 }
 
 SegmentStreamHandler::Values* SegmentStreamHandler::values_ = 0;
@@ -19,6 +19,15 @@
  * A copy of the GNU Lesser General Public License is in the file COPYING.
  */
 
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <string.h>
+#include <ostream>
+#include <stdexcept>
 #include <ndn-ind/util/logging.hpp>
 #include <cnl-cpp/segmented-object-handler.hpp>
 
@@ -49,19 +58,77 @@ SegmentedObjectHandler::Impl::addOnSegmentedObject
   (const OnSegmentedObject& onSegmentedObject)
 {
   uint64_t callbackId = Namespace::getNextCallbackId();
-  onSegmentedObjectCallbacks_[callbackId] = onSegmentedObject;
+  onSegmentedObjectCallbacks_.add(callbackId, onSegmentedObject);
   return callbackId;
 }
 
 void
 SegmentedObjectHandler::Impl::removeCallback(uint64_t callbackId)
 {
-  onSegmentedObjectCallbacks_.erase(callbackId);
+  onSegmentedObjectCallbacks_.remove(callbackId);
+}
+
+void
+SegmentedObjectHandler::Impl::setPayloadSink(ostream& stream)
+{
+  ostream* streamPointer = &stream;
+  onPayload_ = [=](const Blob& payload) {
+    streamPointer->write((const char*)payload.buf(), payload.size());
+    if (!*streamPointer)
+      throw runtime_error
+        ("SegmentedObjectHandler: Error writing to the output stream");
+  };
+}
+
+void
+SegmentedObjectHandler::Impl::setPayloadSink(int fileDescriptor)
+{
+  onPayload_ = [=](const Blob& payload) {
+    size_t offset = 0;
+    while (offset < payload.size()) {
+#if defined(_WIN32)
+      int nBytes = _write
+        (fileDescriptor, payload.buf() + offset,
+         (unsigned int)(payload.size() - offset));
+#else
+      ssize_t nBytes = ::write
+        (fileDescriptor, payload.buf() + offset, payload.size() - offset);
+#endif
+      if (nBytes < 0) {
+        if (errno == EINTR)
+          continue;
+        throw runtime_error
+          (string("SegmentedObjectHandler: Error writing to the file descriptor: ") +
+           strerror(errno));
+      }
+
+      offset += nBytes;
+    }
+  };
 }
 
 void
 SegmentedObjectHandler::Impl::onSegment(Namespace* segmentNamespace)
 {
+  if (onPayload_) {
+    if (segmentNamespace) {
+      Blob payload = segmentNamespace->getBlobObject();
+      totalSize_ += payload.size();
+      // Release the segment from the tree after the callbacks for its state
+      // change finish.
+      segmentNamespace->releasePayloadLater();
+      onPayload_(payload);
+    }
+    else {
+      // Free resources that won't be used anymore.
+      onPayload_ = OnPayload();
+      fireOnSegmentedObject(*namespace_);
+      onSegmentedObjectCallbacks_.clear();
+    }
+
+    return;
+  }
+
   if (segmentNamespace) {
     segments_.push_back(segmentNamespace->getBlobObject());
     totalSize_ += segmentNamespace->getBlobObject().size();
@@ -96,29 +163,19 @@ SegmentedObjectHandler::Impl::onSegment(Namespace* segmentNamespace)
 void
 SegmentedObjectHandler::Impl::fireOnSegmentedObject(Namespace& objectNamespace)
 {
-  // Copy the keys before iterating since callbacks can change the list.
-  vector<uint64_t> keys;
-  keys.reserve(onSegmentedObjectCallbacks_.size());
-  for (map<uint64_t, OnSegmentedObject>::iterator i =
-         onSegmentedObjectCallbacks_.begin();
-       i != onSegmentedObjectCallbacks_.end(); ++i)
-    keys.push_back(i->first);
-
-  for (size_t i = 0; i < keys.size(); ++i) {
-    // A callback on a previous pass may have removed this callback, so check.
-    map<uint64_t, OnSegmentedObject>::iterator entry =
-      onSegmentedObjectCallbacks_.find(keys[i]);
-    if (entry != onSegmentedObjectCallbacks_.end()) {
+  // The registry skips callbacks which are removed by a callback.
+  onSegmentedObjectCallbacks_.dispatch
+    ([&](uint64_t callbackId, OnSegmentedObject& onSegmentedObject) {
       try {
-        entry->second(objectNamespace);
+        onSegmentedObject(objectNamespace);
       } catch (const std::exception& ex) {
         _LOG_ERROR("SegmentStreamHandler::fireOnSegment: Error in onSegmentedObject: " <<
                    ex.what());
       } catch (...) {
         _LOG_ERROR("SegmentStreamHandler::fireOnSegment: Error in onSegmentedObject.");
       }
-    }
-  }
+      return false;
+    });
 }
 
 }